@@ -0,0 +1,127 @@
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include <ModbusTCPSlave.h>
+#include <ModbusTCPMaster.h>
+
+// Compares serving pipelined reads one by one with serving them as a
+// batch. The data source has a fixed cost per access, like a sensor bus:
+// the batch handler reads all requested registers in one access.
+// Master and slave run on the same ESP32, over 127.0.0.1. Every mode
+// starts on a new connection with the first IN_FLIGHT requests queued, so
+// they go out in one segment.
+
+#define SSID "ssid"
+#define PASS "pass"
+#define DURATION 10000  // ms per mode
+#define IN_FLIGHT 5  // slave holds MAX_MODBUS_REQUESTS per client
+#define ACCESS_COST 50  // us per access of the data source
+
+ModbusTCPSlave modbus(1, 502);
+ModbusTCPMaster master(IPAddress(127, 0, 0, 1), 502);
+uint8_t source[1000];
+uint32_t accesses = 0;
+uint32_t completed = 0;
+uint32_t failed = 0;
+uint16_t nextAddress = 0;
+bool batchMode = false;
+bool running = false;
+uint32_t modeStart = 0;
+
+void readSource() {
+  ++accesses;
+  delayMicroseconds(ACCESS_COST);
+}
+
+void onRequest(void* arg, const espModbus::Connection& connection) {
+  const espModbus::Message& request = connection.request();
+  readSource();
+  connection.respond(espModbus::SUCCES, &source[request.address() * 2], espModbus::registersToBytes(request.noRegisters()));
+}
+
+void onBatch(void* arg, espModbus::Batch& batch) {
+  uint16_t first = UINT16_MAX;
+  uint16_t last = 0;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    const espModbus::Message& request = batch.request(i);
+    if (request.functionalCode() != espModbus::READ_HOLD_REGISTERS) continue;
+    first = min(first, request.address());
+    last = max(last, static_cast<uint16_t>(request.address() + request.noRegisters()));
+  }
+  if (first > last) return;  // nothing to read, onRequest serves the rest
+  readSource();
+  for (size_t i = 0; i < batch.size(); ++i) {
+    const espModbus::Message& request = batch.request(i);
+    if (request.functionalCode() != espModbus::READ_HOLD_REGISTERS) continue;
+    batch.respond(i, espModbus::SUCCES, &source[request.address() * 2], espModbus::registersToBytes(request.noRegisters()));
+  }
+}
+
+void onResponse(void* arg, espModbus::Error error, const espModbus::Message& request,
+                const espModbus::ResponseMessage* response) {
+  if (error == espModbus::SUCCES) {
+    ++completed;
+  } else {
+    ++failed;
+  }
+  if (running) {
+    master.readHoldingRegisters(1, nextAddress, 10, onResponse);
+    nextAddress = (nextAddress + 10) % 500;
+  }
+}
+
+void startMode() {
+  accesses = 0;
+  completed = 0;
+  failed = 0;
+  running = true;
+  if (batchMode) {
+    modbus.onBatch(onBatch);
+  } else {
+    modbus.onBatch(nullptr);
+  }
+  for (size_t i = 0; i < IN_FLIGHT; ++i) {
+    master.readHoldingRegisters(1, nextAddress, 10, onResponse);
+    nextAddress = (nextAddress + 10) % 500;
+  }
+  master.connect();
+  while (!master.connected()) {
+    delay(1);
+  }
+  modeStart = millis();
+}
+
+void setup() {
+  Serial.begin(115200);
+  delay(100);
+  WiFi.persistent(false);
+  WiFi.begin(SSID, PASS);
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(1);
+  }
+
+  modbus.onRequest(onRequest);
+  modbus.begin();
+  master.setMaxInFlight(IN_FLIGHT);
+  startMode();
+}
+
+void loop() {
+  delay(10);
+  if (!running || millis() - modeStart < DURATION) return;
+  running = false;
+  while (master.pending() > 0) {
+    delay(1);
+  }
+  Serial.printf("%s: %.1f requests/s, %.2f accesses/request, %u failed\n",
+                batchMode ? "onBatch" : "onRequest", completed * 1000.0f / DURATION,
+                completed ? static_cast<float>(accesses) / completed : 0.0f, failed);
+  master.disconnect();
+  while (master.connected()) {
+    delay(1);
+  }
+  if (!batchMode) {
+    batchMode = true;
+    startMode();
+  }
+}
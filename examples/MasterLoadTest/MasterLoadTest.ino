@@ -0,0 +1,82 @@
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include <ModbusTCPSlave.h>
+#include <ModbusTCPMaster.h>
+
+// Load test of the pipelined master against the slave on the same ESP32,
+// over 127.0.0.1. Every response issues the next request, the number of
+// requests in flight is stepped through WINDOWS.
+
+#define SSID "ssid"
+#define PASS "pass"
+#define DURATION 10000  // ms per window
+
+ModbusTCPSlave modbus(1, 502);
+ModbusTCPMaster master(IPAddress(127, 0, 0, 1), 502);
+const size_t windows[] = {1, 2, 4, 5};  // slave holds MAX_MODBUS_REQUESTS per client
+size_t window = 0;
+uint32_t windowStart = 0;
+uint32_t completed = 0;
+uint32_t failed = 0;
+bool running = false;
+
+void onRequest(void* arg, const espModbus::Connection& connection) {
+  uint8_t data[250];
+  size_t noBytes = espModbus::registersToBytes(connection.request().noRegisters());
+  memset(data, 0x30, noBytes);
+  connection.respond(espModbus::SUCCES, data, noBytes);
+}
+
+void onResponse(void* arg, espModbus::Error error, const espModbus::Message& request,
+                const espModbus::ResponseMessage* response) {
+  if (error == espModbus::SUCCES) {
+    ++completed;
+  } else {
+    ++failed;
+  }
+  if (running) master.readHoldingRegisters(1, 0, 10, onResponse);
+}
+
+void startWindow() {
+  completed = 0;
+  failed = 0;
+  running = true;
+  master.setMaxInFlight(windows[window]);
+  for (size_t i = 0; i < windows[window]; ++i) {
+    master.readHoldingRegisters(1, 0, 10, onResponse);
+  }
+  windowStart = millis();
+}
+
+void setup() {
+  Serial.begin(115200);
+  delay(100);
+  WiFi.persistent(false);
+  WiFi.begin(SSID, PASS);
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(1);
+  }
+
+  modbus.onRequest(onRequest);
+  modbus.begin();
+  master.connect();
+  while (!master.connected()) {
+    delay(1);
+  }
+  startWindow();
+}
+
+void loop() {
+  delay(10);
+  if (window >= sizeof(windows) / sizeof(windows[0])) return;
+  if (millis() - windowStart < DURATION) return;
+  running = false;
+  while (master.pending() > 0) {
+    delay(1);
+  }
+  Serial.printf("in flight %u: %.1f requests/s, %u failed\n",
+                windows[window], completed * 1000.0f / DURATION, failed);
+  ++window;
+  if (window < sizeof(windows) / sizeof(windows[0])) startWindow();
+}
@@ -0,0 +1,84 @@
+#include <Arduino.h>
+
+#include <MessageParser.h>
+
+// Feeds the request parser with valid frames hidden in garbage and
+// reports throughput and the number of frames recovered.
+// No network needed: this runs on the bare ESP32.
+
+#define NUMBER_FRAMES 2000
+#define MAX_GARBAGE 64
+#define CHUNK 1460  // typical TCP segment
+
+enum Garbage : uint8_t {
+  NO_ZEROS,      // random bytes, no 0x00: skipped a word at a time
+  MANY_ZEROS,    // half of the bytes 0x00: lots of header candidates
+  FAKE_HEADERS   // plausible MBAP headers with wrong length/function code
+};
+
+size_t fillStream(uint8_t* stream, Garbage type) {
+  size_t pos = 0;
+  for (uint16_t i = 0; i < NUMBER_FRAMES; ++i) {
+    size_t garbage = random(MAX_GARBAGE);
+    for (size_t j = 0; j < garbage; ++j) {
+      uint8_t b = random(256);
+      switch (type) {
+        case NO_ZEROS:
+          b |= 0x01;
+          break;
+        case MANY_ZEROS:
+          if (random(2)) b = 0;
+          break;
+        case FAKE_HEADERS:
+          if (j % 8 >= 2 && j % 8 <= 4) b = 0;
+          break;
+      }
+      stream[pos++] = b;
+    }
+    const uint8_t frame[12] = {espModbus::high(i), espModbus::low(i), 0, 0, 0, 6, 1, 3, 0, 0, 0, 10};
+    memcpy(&stream[pos], frame, sizeof(frame));
+    pos += sizeof(frame);
+  }
+  return pos;
+}
+
+void benchmark(const char* name, Garbage type) {
+  uint8_t* stream = new uint8_t[NUMBER_FRAMES * (MAX_GARBAGE + 12)];
+  size_t length = fillStream(stream, type);
+  espModbus::MessageParser<espModbus::RequestMessage*> parser;
+  espModbus::RequestMessage* request = nullptr;
+  uint32_t found = 0;
+  uint32_t start = micros();
+  for (size_t pos = 0; pos < length; pos += CHUNK) {
+    uint8_t* data = &stream[pos];
+    size_t len = std::min(static_cast<size_t>(CHUNK), length - pos);
+    while (true) {
+      size_t parsed = parser.parse(data, len, request);
+      data += parsed;
+      len -= parsed;
+      if (request) {
+        ++found;
+        delete request;
+        continue;
+      }
+      if (len == 0 || parsed == 0) break;
+    }
+  }
+  uint32_t duration = micros() - start;
+  Serial.printf("%-13s %6u bytes  %5u/%u frames  %6u us  %.3f us/byte\n",
+                name, length, found, NUMBER_FRAMES, duration, static_cast<float>(duration) / length);
+  delete[] stream;
+}
+
+void setup() {
+  Serial.begin(115200);
+  delay(100);
+  randomSeed(1);
+  benchmark("no zeros", NO_ZEROS);
+  benchmark("many zeros", MANY_ZEROS);
+  benchmark("fake headers", FAKE_HEADERS);
+}
+
+void loop() {
+  delay(1000);
+}
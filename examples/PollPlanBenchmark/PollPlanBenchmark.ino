@@ -0,0 +1,58 @@
+#include <Arduino.h>
+
+#include <PollPlan.h>
+
+// Plans the poll cycle of a master reading a few hundred scattered tags
+// and reports the requests per cycle with one request per tag and after
+// merging.
+// Every unit has a hole in its holding registers that must not be read.
+// No network needed: this runs on the bare ESP32.
+
+#define NUMBER_UNITS 10
+#define TAGS_PER_UNIT 40
+#define NUMBER_TAGS (NUMBER_UNITS * TAGS_PER_UNIT)
+
+espModbus::PollPlan plan(NUMBER_TAGS);
+
+void setup() {
+  Serial.begin(115200);
+  delay(100);
+  randomSeed(1);
+  for (uint8_t unit = 1; unit <= NUMBER_UNITS; ++unit) {
+    for (size_t t = 0; t < TAGS_PER_UNIT; ++t) {
+      switch (random(4)) {
+        case 0:
+          plan.add(unit, espModbus::READ_COILS, random(500), 1);
+          break;
+        case 1:
+          plan.add(unit, espModbus::READ_INPUT_REGISTERS, random(300), 1 + random(2));
+          break;
+        default:
+          plan.add(unit, espModbus::READ_HOLD_REGISTERS, random(1000), 1 + random(4));
+      }
+    }
+    plan.forbid(unit, espModbus::READ_HOLD_REGISTERS, 500, 100);
+  }
+  // slow units: short requests, little waste
+  plan.setLimits(9, 32, 8);
+  plan.setLimits(10, 32, 8);
+
+  uint32_t start = micros();
+  size_t requests = plan.build();
+  uint32_t elapsed = micros() - start;
+  Serial.printf("tags: %u\n", plan.numberTags());
+  Serial.printf("requests per cycle, one per tag: %u\n", plan.numberTags());
+  Serial.printf("requests per cycle, merged: %u\n", requests);
+  Serial.printf("planning: %u us\n", elapsed);
+  size_t registers = 0;
+  for (size_t r = 0; r < requests; ++r) {
+    if (plan.request(r).fc == espModbus::READ_HOLD_REGISTERS || plan.request(r).fc == espModbus::READ_INPUT_REGISTERS) {
+      registers += plan.request(r).count;
+    }
+  }
+  Serial.printf("registers read per cycle: %u\n", registers);
+}
+
+void loop() {
+  delay(1000);
+}
@@ -0,0 +1,74 @@
+#include <Arduino.h>
+
+#include <SparseRegisters.h>
+
+// Simulates a farm of devices with a scattered register map and reports
+// memory per device and lookup time.
+// Unit ids are 8 bit, so the units are spread over several maps, as they
+// would be over several slaves. Stops at the first map that doesn't fit.
+// No network needed: this runs on the bare ESP32.
+
+#define NUMBER_UNITS 1000
+#define UNITS_PER_MAP 250
+#define NUMBER_MAPS ((NUMBER_UNITS + UNITS_PER_MAP - 1) / UNITS_PER_MAP)
+#define NUMBER_READS 100000
+
+// 40001, 41000, 45000 - 45100
+const struct {
+  uint16_t address;
+  uint16_t noRegisters;
+} deviceMap[] = {{0, 1}, {999, 1}, {4999, 101}};
+const size_t rangesPerDevice = sizeof(deviceMap) / sizeof(deviceMap[0]);
+const size_t registersPerDevice = 1 + 1 + 101;
+
+espModbus::SparseRegisters* maps[NUMBER_MAPS] = {nullptr};
+
+void setup() {
+  Serial.begin(115200);
+  delay(100);
+  uint32_t heapBefore = ESP.getFreeHeap();
+  size_t footprint = 0;
+  size_t units = 0;
+  for (size_t m = 0; m < NUMBER_MAPS; ++m) {
+    espModbus::SparseRegisters* map = new espModbus::SparseRegisters(rangesPerDevice * UNITS_PER_MAP,
+                                                                     registersPerDevice * UNITS_PER_MAP);
+    if (map->footprint() == sizeof(*map)) {  // storage allocation failed
+      delete map;
+      break;
+    }
+    for (size_t u = 0; u < UNITS_PER_MAP && units < NUMBER_UNITS; ++u, ++units) {
+      for (size_t r = 0; r < rangesPerDevice; ++r) {
+        map->add(u, deviceMap[r].address, deviceMap[r].noRegisters);
+      }
+    }
+    footprint += map->footprint();
+    maps[m] = map;
+  }
+  uint32_t heapUsed = heapBefore - ESP.getFreeHeap();
+  Serial.printf("units: %u\n", units);
+  Serial.printf("footprint: %u bytes, %u bytes per unit\n", footprint, footprint / units);
+  Serial.printf("heap used: %u bytes, %u bytes per unit\n", heapUsed, heapUsed / units);
+  Serial.printf("flat array 40001 - 45100: %u bytes per unit\n", 5100 * 2);
+
+  uint8_t data[250];
+  uint32_t ok = 0;
+  uint32_t start = micros();
+  for (uint32_t i = 0; i < NUMBER_READS; ++i) {
+    size_t unit = i % units;
+    if (maps[unit / UNITS_PER_MAP]->read(unit % UNITS_PER_MAP, 4999 + i % 50, 50, data) == espModbus::SUCCES) ++ok;
+  }
+  uint32_t elapsed = micros() - start;
+  Serial.printf("read 50 registers: %.2f us (%u/%u ok)\n", static_cast<float>(elapsed) / NUMBER_READS, ok, NUMBER_READS);
+
+  start = micros();
+  for (uint32_t i = 0; i < NUMBER_READS; ++i) {
+    size_t unit = i % units;
+    maps[unit / UNITS_PER_MAP]->read(unit % UNITS_PER_MAP, 4998, 2, data);  // hole
+  }
+  elapsed = micros() - start;
+  Serial.printf("read over a hole: %.2f us\n", static_cast<float>(elapsed) / NUMBER_READS);
+}
+
+void loop() {
+  delay(1000);
+}
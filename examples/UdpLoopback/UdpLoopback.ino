@@ -0,0 +1,50 @@
+// Modbus UDP on loopback: the sketch polls its own slave over 127.0.0.1,
+// no network or master needed.
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <AsyncUDP.h>
+
+#include <ModbusTCPSlave.h>
+
+ModbusTCPSlave modbus(1, 502);
+AsyncUDP master;
+uint16_t transactionId = 0;
+uint32_t sentAt = 0;
+uint32_t replies = 0;
+
+void onRequest(void* arg, const espModbus::Connection& connection) {
+  if (connection.request().functionalCode() != espModbus::READ_HOLD_REGISTERS) {
+    connection.respond(espModbus::ILLEGAL_FUNCTION);
+    return;
+  }
+  uint8_t data[250];
+  size_t noBytes = espModbus::registersToBytes(connection.request().noRegisters());
+  memset(data, 0x30, noBytes);
+  connection.respond(espModbus::SUCCES, data, noBytes);
+}
+
+void onReply(AsyncUDPPacket& packet) {  // NOLINT (non const reference)
+  uint32_t roundtrip = micros() - sentAt;
+  ++replies;
+  if (replies % 100 == 0) {
+    Serial.printf("reply %u: %u bytes, %u us\n", replies, packet.length(), roundtrip);
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+  WiFi.mode(WIFI_STA);  // starts the TCP/IP stack
+  modbus.onRequest(onRequest);
+  modbus.begin();
+  if (!modbus.beginUdp(502)) Serial.print("UDP listener failed\n");
+  master.listen(5020);
+  master.onPacket(onReply);
+}
+
+void loop() {
+  delay(10);
+  espModbus::Request03 request(++transactionId, 1, 0, 10);
+  sentAt = micros();
+  master.writeTo(request.data(), request.length(), IPAddress(127, 0, 0, 1), 502);
+}
@@ -42,6 +42,34 @@ void onRequest(void* arg, const espModbus::Connection& connection) {
       delete[] data;
       return;
       }
+    case espModbus::READ_INPUT_REGISTERS:
+      {
+      size_t noBytes = espModbus::registersToBytes(connection.request().noRegisters());
+      uint8_t* data = new uint8_t[noBytes];
+      memset(data, 0x40, noBytes);  // <-- fill in actual data
+      connection.respond(espModbus::SUCCES, data, noBytes);
+      delete[] data;
+      return;
+      }
+    case espModbus::WRITE_COIL:
+    case espModbus::WRITE_HOLD_REGISTER:
+    case espModbus::WRITE_MULT_COILS:
+    case espModbus::WRITE_MULT_REGISTERS:
+      // address and quantity are already validated
+      // payload() holds the values as sent by the master
+      Serial.printf("write %d bytes at %d\n", connection.request().payloadLength(), connection.request().address());
+      connection.respond(espModbus::SUCCES);
+      return;
+    case espModbus::READ_WRITE_MULT_REGISTERS:
+      {
+      // apply payload() at writeAddress() first, then read back
+      size_t noBytes = espModbus::registersToBytes(connection.request().noRegisters());
+      uint8_t* data = new uint8_t[noBytes];
+      memset(data, 0x30, noBytes);  // <-- fill in actual data
+      connection.respond(espModbus::SUCCES, data, noBytes);
+      delete[] data;
+      return;
+      }
     default:
       Serial.printf("Request not implemented");
       connection.respond(espModbus::ILLEGAL_FUNCTION);
@@ -0,0 +1,108 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+// Host build of the library: AsyncTCP on an in-process network, see
+// HostNetwork.h. Only the part of the API the library uses.
+
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint*_t
+#include <functional>  // std::function
+#include <vector>
+
+#include <IPAddress.h>
+
+class AsyncClient;
+class AsyncServer;
+
+#define ASYNC_WRITE_FLAG_COPY 0x01
+
+typedef std::function<void(void*, AsyncClient*)> AcConnectHandler;
+typedef std::function<void(void*, AsyncClient*, size_t len, uint32_t time)> AcAckHandler;
+typedef std::function<void(void*, AsyncClient*, int8_t error)> AcErrorHandler;
+typedef std::function<void(void*, AsyncClient*, void* data, size_t len)> AcDataHandler;
+typedef std::function<void(void*, AsyncClient*, uint32_t time)> AcTimeoutHandler;
+
+class AsyncClient {
+ public:
+  explicit AsyncClient(void* pcb = nullptr);
+  ~AsyncClient();
+  bool connect(IPAddress ip, uint16_t port);
+  void close(bool now = false);
+  bool connected();
+  bool disconnected();
+  size_t space();
+  size_t add(const char* data, size_t size, uint8_t apiflags = ASYNC_WRITE_FLAG_COPY);
+  bool send();
+  size_t write(const char* data, size_t size, uint8_t apiflags = ASYNC_WRITE_FLAG_COPY);
+  void setNoDelay(bool nodelay);
+  void setRxTimeout(uint32_t timeout);
+  IPAddress remoteIP();
+  uint16_t remotePort();
+  IPAddress localIP();
+
+  void onConnect(AcConnectHandler cb, void* arg = nullptr);
+  void onDisconnect(AcConnectHandler cb, void* arg = nullptr);
+  void onAck(AcAckHandler cb, void* arg = nullptr);
+  void onError(AcErrorHandler cb, void* arg = nullptr);
+  void onData(AcDataHandler cb, void* arg = nullptr);
+  void onTimeout(AcTimeoutHandler cb, void* arg = nullptr);
+  void onPoll(AcConnectHandler cb, void* arg = nullptr);
+
+  // in-process network
+  AcConnectHandler _connectCb;
+  void* _connectArg;
+  AcConnectHandler _disconnectCb;
+  void* _disconnectArg;
+  AcAckHandler _ackCb;
+  void* _ackArg;
+  AcErrorHandler _errorCb;
+  void* _errorArg;
+  AcDataHandler _dataCb;
+  void* _dataArg;
+  AcConnectHandler _pollCb;
+  void* _pollArg;
+  AsyncClient* _peer;
+  IPAddress _localIP;
+  uint16_t _localPort;
+  bool _connected;
+  std::vector<uint8_t> _unsent;
+};
+
+class AsyncServer {
+ public:
+  explicit AsyncServer(uint16_t port);
+  ~AsyncServer();
+  void onClient(AcConnectHandler cb, void* arg);
+  void begin();
+  void end();
+  void setNoDelay(bool nodelay);
+
+  // in-process network
+  uint16_t _port;
+  AcConnectHandler _clientCb;
+  void* _clientArg;
+};
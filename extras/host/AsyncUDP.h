@@ -0,0 +1,68 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+// Host build of the library: AsyncUDP on an in-process network, see
+// HostNetwork.h. Only the part of the API the library uses.
+
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint*_t
+#include <functional>  // std::function
+
+#include <IPAddress.h>
+
+class AsyncUDPPacket {
+ public:
+  AsyncUDPPacket(uint8_t* data, size_t length, IPAddress remoteIP, uint16_t remotePort);
+  uint8_t* data();
+  size_t length();
+  IPAddress remoteIP();
+  uint16_t remotePort();
+
+ private:
+  uint8_t* _data;
+  size_t _length;
+  IPAddress _remoteIP;
+  uint16_t _remotePort;
+};
+
+typedef std::function<void(void*, AsyncUDPPacket& packet)> AuPacketHandlerFunctionWithArg;
+
+class AsyncUDP {
+ public:
+  AsyncUDP();
+  ~AsyncUDP();
+  bool listen(uint16_t port);
+  void close();
+  void onPacket(AuPacketHandlerFunctionWithArg cb, void* arg = nullptr);
+  size_t writeTo(const uint8_t* data, size_t len, const IPAddress addr, uint16_t port);
+
+  // in-process network
+  AuPacketHandlerFunctionWithArg _packetCb;
+  void* _packetArg;
+  IPAddress _localIP;
+  uint16_t _port;
+};
@@ -0,0 +1,44 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+// Host build of the library: a clock the test drives. Once frozen,
+// millis() and micros() only move when the test advances them or
+// something calls delay(), so results that depend on timing are the same
+// on every run:
+//
+//   host::freezeClock();
+//   delay(8);                     // a handler taking 8 ms, returns at once
+//
+// Semaphores and timers keep waiting in real time.
+
+#pragma once
+
+#include <stdint.h>  // for uint*_t
+
+namespace host {
+
+void freezeClock();
+void advance(uint32_t ms);
+
+}  // end namespace host
@@ -0,0 +1,60 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+// Host build of the library: an in-process network for AsyncTCP and
+// AsyncUDP. Nothing is delivered until the test pumps the network, so a
+// test decides what arrives together:
+//
+//   ModbusTCPSlave slave(1);      // listens on port 502 of any address
+//   ModbusTCPMaster master(IPAddress(127, 0, 0, 1));
+//   host::setLocalIP(IPAddress(10, 0, 0, 2));  // address of next clients
+//   master.connect();
+//   while (host::pump()) {}       // connect, requests, responses, acks
+//
+// Every send() is one segment and is delivered with one onData call.
+// After delivery the sender gets onAck.
+
+#pragma once
+
+#include <stddef.h>  // for size_t
+
+#include <IPAddress.h>
+
+namespace host {
+
+// deliver everything sent so far, returns the number of events
+size_t pump();
+
+// call onPoll of every client, as AsyncTCP does about every 500 ms
+void poll();
+
+// address used by clients and UDP sockets created from now on
+void setLocalIP(IPAddress ip);
+
+// segments and datagrams sent since the start
+size_t segments();
+size_t datagrams();
+
+}  // end namespace host
@@ -0,0 +1,55 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+// Host build of the library: IPv4 address as in the Arduino core.
+
+#pragma once
+
+#include <stdint.h>
+
+class IPAddress {
+ public:
+  IPAddress() :
+    _address(0) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) :
+    _address(a | b << 8 | c << 16 | static_cast<uint32_t>(d) << 24) {}
+  IPAddress(uint32_t address) :  // NOLINT (implicit, as in the Arduino core)
+    _address(address) {}
+  operator uint32_t() const {
+    return _address;
+  }
+  bool operator==(const IPAddress& other) const {
+    return _address == other._address;
+  }
+  bool operator!=(const IPAddress& other) const {
+    return _address != other._address;
+  }
+  uint8_t operator[](int index) const {
+    return _address >> (index * 8);
+  }
+
+ private:
+  uint32_t _address;
+};
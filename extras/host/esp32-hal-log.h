@@ -0,0 +1,45 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+// Host build of the library: logging goes to stderr when HOST_VERBOSE is
+// defined and is discarded otherwise.
+
+#pragma once
+
+#include <cstdio>
+
+#ifdef HOST_VERBOSE
+#define log_v(format, ...) fprintf(stderr, "V " format "\n", ##__VA_ARGS__)
+#define log_d(format, ...) fprintf(stderr, "D " format "\n", ##__VA_ARGS__)
+#define log_i(format, ...) fprintf(stderr, "I " format "\n", ##__VA_ARGS__)
+#define log_w(format, ...) fprintf(stderr, "W " format "\n", ##__VA_ARGS__)
+#define log_e(format, ...) fprintf(stderr, "E " format "\n", ##__VA_ARGS__)
+#else
+#define log_v(...)
+#define log_d(...)
+#define log_i(...)
+#define log_w(...)
+#define log_e(...)
+#endif
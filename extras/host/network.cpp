@@ -0,0 +1,405 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+// Host build of the library: in-process network behind AsyncTCP and
+// AsyncUDP, see HostNetwork.h.
+
+#include <algorithm>  // std::find
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <AsyncTCP.h>
+#include <AsyncUDP.h>
+#include <HostNetwork.h>
+
+namespace {
+
+const size_t SEND_BUFFER = 5744;  // TCP_SND_BUF of the ESP32
+
+struct Event {
+  enum Type {
+    CONNECT,
+    DATA,
+    DISCONNECT,
+    DATAGRAM
+  } type;
+  AsyncClient* client;  // receiver
+  AsyncClient* from;  // sender of DATA
+  AsyncUDP* udp;  // receiver of DATAGRAM
+  uint16_t port;  // server port of CONNECT, source port of DATAGRAM
+  IPAddress ip;  // source of DATAGRAM
+  std::vector<uint8_t> bytes;
+};
+
+std::deque<Event> events;
+std::vector<AsyncClient*> clients;
+std::vector<AsyncUDP*> sockets;
+std::map<uint16_t, AsyncServer*> servers;
+IPAddress hostIP(127, 0, 0, 1);
+uint16_t nextPort = 40000;
+size_t segmentCount = 0;
+size_t datagramCount = 0;
+
+void post(Event::Type type, AsyncClient* client) {
+  Event event = {type, client, nullptr, nullptr, 0, IPAddress(), {}};
+  events.push_back(event);
+}
+
+bool alive(AsyncClient* client) {
+  return std::find(clients.begin(), clients.end(), client) != clients.end();
+}
+
+void unlink(AsyncClient* client) {
+  AsyncClient* peer = client->_peer;
+  client->_peer = nullptr;
+  client->_connected = false;
+  client->_unsent.clear();
+  if (peer) {
+    peer->_peer = nullptr;
+    if (peer->_connected) {
+      peer->_connected = false;
+      peer->_unsent.clear();
+      post(Event::DISCONNECT, peer);
+    }
+  }
+}
+
+void establish(AsyncClient* client, uint16_t port) {
+  auto server = servers.find(port);
+  if (server == servers.end()) {
+    if (client->_errorCb) client->_errorCb(client->_errorArg, client, -14);  // ERR_CONN
+    if (client->_disconnectCb) client->_disconnectCb(client->_disconnectArg, client);
+    return;
+  }
+  AsyncClient* accepted = new AsyncClient();
+  accepted->_localPort = port;
+  accepted->_localIP = IPAddress(127, 0, 0, 1);
+  accepted->_peer = client;
+  accepted->_connected = true;
+  client->_peer = accepted;
+  client->_connected = true;
+  server->second->_clientCb(server->second->_clientArg, accepted);
+  // the server may have refused and closed the connection already
+  if (client->_connected && client->_connectCb) client->_connectCb(client->_connectArg, client);
+}
+
+void deliver(Event* event) {
+  switch (event->type) {
+    case Event::CONNECT:
+      establish(event->client, event->port);
+      break;
+    case Event::DATA:
+      if (event->client->_connected && event->client->_dataCb) {
+        event->client->_dataCb(event->client->_dataArg, event->client, event->bytes.data(), event->bytes.size());
+      }
+      if (event->from && alive(event->from) && event->from->_ackCb) {
+        event->from->_ackCb(event->from->_ackArg, event->from, event->bytes.size(), 0);
+      }
+      break;
+    case Event::DISCONNECT:
+      if (event->client->_disconnectCb) event->client->_disconnectCb(event->client->_disconnectArg, event->client);
+      break;
+    case Event::DATAGRAM:
+      if (event->udp->_packetCb) {
+        AsyncUDPPacket packet(event->bytes.data(), event->bytes.size(), event->ip, event->port);
+        event->udp->_packetCb(event->udp->_packetArg, packet);
+      }
+      break;
+  }
+}
+
+}  // end anonymous namespace
+
+namespace host {
+
+size_t pump() {
+  size_t n = events.size();
+  for (size_t i = 0; i < n && !events.empty(); ++i) {
+    Event event = events.front();
+    events.pop_front();
+    deliver(&event);
+  }
+  return n;
+}
+
+void poll() {
+  std::vector<AsyncClient*> polled = clients;
+  for (AsyncClient* client : polled) {
+    if (alive(client) && client->_connected && client->_pollCb) client->_pollCb(client->_pollArg, client);
+  }
+}
+
+void setLocalIP(IPAddress ip) {
+  hostIP = ip;
+}
+
+size_t segments() {
+  return segmentCount;
+}
+
+size_t datagrams() {
+  return datagramCount;
+}
+
+}  // end namespace host
+
+AsyncClient::AsyncClient(void* pcb) :
+  _connectCb(nullptr),
+  _connectArg(nullptr),
+  _disconnectCb(nullptr),
+  _disconnectArg(nullptr),
+  _ackCb(nullptr),
+  _ackArg(nullptr),
+  _errorCb(nullptr),
+  _errorArg(nullptr),
+  _dataCb(nullptr),
+  _dataArg(nullptr),
+  _pollCb(nullptr),
+  _pollArg(nullptr),
+  _peer(nullptr),
+  _localIP(hostIP),
+  _localPort(0),
+  _connected(false),
+  _unsent() {
+    (void)pcb;
+    clients.push_back(this);
+}
+
+AsyncClient::~AsyncClient() {
+  unlink(this);
+  clients.erase(std::find(clients.begin(), clients.end(), this));
+  for (auto it = events.begin(); it != events.end();) {
+    if (it->client == this) {
+      it = events.erase(it);
+    } else {
+      if (it->from == this) it->from = nullptr;
+      ++it;
+    }
+  }
+}
+
+bool AsyncClient::connect(IPAddress ip, uint16_t port) {
+  (void)ip;  // every address is this host
+  if (_connected) return false;
+  _localIP = hostIP;
+  _localPort = nextPort++;
+  Event event = {Event::CONNECT, this, nullptr, nullptr, port, IPAddress(), {}};
+  events.push_back(event);
+  return true;
+}
+
+void AsyncClient::close(bool now) {
+  (void)now;
+  if (!_connected) return;
+  unlink(this);
+  post(Event::DISCONNECT, this);
+}
+
+bool AsyncClient::connected() {
+  return _connected;
+}
+
+bool AsyncClient::disconnected() {
+  return !_connected;
+}
+
+size_t AsyncClient::space() {
+  return _connected ? SEND_BUFFER - _unsent.size() : 0;
+}
+
+size_t AsyncClient::add(const char* data, size_t size, uint8_t apiflags) {
+  (void)apiflags;
+  if (size > space()) return 0;
+  _unsent.insert(_unsent.end(), data, data + size);
+  return size;
+}
+
+bool AsyncClient::send() {
+  if (!_connected || _unsent.empty()) return false;
+  Event event = {Event::DATA, _peer, this, nullptr, 0, IPAddress(), {}};
+  event.bytes.swap(_unsent);
+  events.push_back(event);
+  ++segmentCount;
+  return true;
+}
+
+size_t AsyncClient::write(const char* data, size_t size, uint8_t apiflags) {
+  size_t added = add(data, size, apiflags);
+  if (added) send();
+  return added;
+}
+
+void AsyncClient::setNoDelay(bool nodelay) {
+  (void)nodelay;
+}
+
+void AsyncClient::setRxTimeout(uint32_t timeout) {
+  (void)timeout;
+}
+
+IPAddress AsyncClient::remoteIP() {
+  return _peer ? _peer->_localIP : IPAddress();
+}
+
+uint16_t AsyncClient::remotePort() {
+  return _peer ? _peer->_localPort : 0;
+}
+
+IPAddress AsyncClient::localIP() {
+  return _localIP;
+}
+
+void AsyncClient::onConnect(AcConnectHandler cb, void* arg) {
+  _connectCb = cb;
+  _connectArg = arg;
+}
+
+void AsyncClient::onDisconnect(AcConnectHandler cb, void* arg) {
+  _disconnectCb = cb;
+  _disconnectArg = arg;
+}
+
+void AsyncClient::onAck(AcAckHandler cb, void* arg) {
+  _ackCb = cb;
+  _ackArg = arg;
+}
+
+void AsyncClient::onError(AcErrorHandler cb, void* arg) {
+  _errorCb = cb;
+  _errorArg = arg;
+}
+
+void AsyncClient::onData(AcDataHandler cb, void* arg) {
+  _dataCb = cb;
+  _dataArg = arg;
+}
+
+void AsyncClient::onTimeout(AcTimeoutHandler cb, void* arg) {
+  (void)cb;
+  (void)arg;
+}
+
+void AsyncClient::onPoll(AcConnectHandler cb, void* arg) {
+  _pollCb = cb;
+  _pollArg = arg;
+}
+
+AsyncServer::AsyncServer(uint16_t port) :
+  _port(port),
+  _clientCb(nullptr),
+  _clientArg(nullptr) {}
+
+AsyncServer::~AsyncServer() {
+  end();
+}
+
+void AsyncServer::onClient(AcConnectHandler cb, void* arg) {
+  _clientCb = cb;
+  _clientArg = arg;
+}
+
+void AsyncServer::begin() {
+  servers[_port] = this;
+}
+
+void AsyncServer::end() {
+  auto server = servers.find(_port);
+  if (server != servers.end() && server->second == this) servers.erase(server);
+}
+
+void AsyncServer::setNoDelay(bool nodelay) {
+  (void)nodelay;
+}
+
+AsyncUDPPacket::AsyncUDPPacket(uint8_t* data, size_t length, IPAddress remoteIP, uint16_t remotePort) :
+  _data(data),
+  _length(length),
+  _remoteIP(remoteIP),
+  _remotePort(remotePort) {}
+
+uint8_t* AsyncUDPPacket::data() {
+  return _data;
+}
+
+size_t AsyncUDPPacket::length() {
+  return _length;
+}
+
+IPAddress AsyncUDPPacket::remoteIP() {
+  return _remoteIP;
+}
+
+uint16_t AsyncUDPPacket::remotePort() {
+  return _remotePort;
+}
+
+AsyncUDP::AsyncUDP() :
+  _packetCb(nullptr),
+  _packetArg(nullptr),
+  _localIP(),
+  _port(0) {}
+
+AsyncUDP::~AsyncUDP() {
+  close();
+}
+
+bool AsyncUDP::listen(uint16_t port) {
+  for (AsyncUDP* socket : sockets) {
+    if (socket->_port == port) return false;
+  }
+  _localIP = hostIP;
+  _port = port;
+  sockets.push_back(this);
+  return true;
+}
+
+void AsyncUDP::close() {
+  auto socket = std::find(sockets.begin(), sockets.end(), this);
+  if (socket != sockets.end()) sockets.erase(socket);
+  for (auto it = events.begin(); it != events.end();) {
+    it = (it->udp == this) ? events.erase(it) : it + 1;
+  }
+  _port = 0;
+}
+
+void AsyncUDP::onPacket(AuPacketHandlerFunctionWithArg cb, void* arg) {
+  _packetCb = cb;
+  _packetArg = arg;
+}
+
+// delivered to the socket listening on port, whatever the address
+size_t AsyncUDP::writeTo(const uint8_t* data, size_t len, const IPAddress addr, uint16_t port) {
+  (void)addr;
+  if (_port == 0 && !listen(nextPort++)) return 0;
+  ++datagramCount;
+  for (AsyncUDP* socket : sockets) {
+    if (socket->_port != port) continue;
+    Event event = {Event::DATAGRAM, nullptr, nullptr, socket, _port, _localIP, {}};
+    event.bytes.assign(data, data + len);
+    events.push_back(event);
+  }
+  return len;
+}
@@ -0,0 +1,337 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+// Host build of the library: FreeRTOS semaphores, queues, tasks and
+// timers, Arduino time and the clock of HostClock.h.
+
+#include <pthread.h>  // pthread_exit
+#include <stdio.h>
+#include <stdlib.h>  // abort
+#include <string.h>  // memcpy
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <freertos/timers.h>
+#include <esp32-hal.h>
+#include <HostClock.h>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+const Clock::time_point start = Clock::now();
+std::atomic<bool> frozen(false);
+std::atomic<uint32_t> frozenMicros(0);
+
+}  // end anonymous namespace
+
+// a counting semaphore of one, mutexes remember their owner for
+// recursive takes
+struct HostSemaphore {
+  std::mutex mutex;
+  std::condition_variable cv;
+  unsigned int count;
+  bool recursive;
+  std::thread::id owner;
+  unsigned int depth;
+};
+
+static SemaphoreHandle_t create(unsigned int count, bool recursive) {
+  HostSemaphore* semaphore = new HostSemaphore;
+  semaphore->count = count;
+  semaphore->recursive = recursive;
+  semaphore->depth = 0;
+  return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return create(0, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  return create(1, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() {
+  return create(1, true);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(semaphore->mutex);
+  auto available = [semaphore] { return semaphore->count > 0; };
+  if (ticks == portMAX_DELAY) {
+    semaphore->cv.wait(lock, available);
+  } else if (!semaphore->cv.wait_for(lock, std::chrono::milliseconds(ticks), available)) {
+    return pdFALSE;
+  }
+  --semaphore->count;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  std::lock_guard<std::mutex> lock(semaphore->mutex);
+  if (semaphore->count > 0) return pdFALSE;
+  ++semaphore->count;
+  semaphore->cv.notify_one();
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t semaphore, TickType_t ticks) {
+  {
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    if (semaphore->depth > 0 && semaphore->owner == std::this_thread::get_id()) {
+      ++semaphore->depth;
+      return pdTRUE;
+    }
+  }
+  if (xSemaphoreTake(semaphore, ticks) != pdTRUE) return pdFALSE;
+  std::lock_guard<std::mutex> lock(semaphore->mutex);
+  semaphore->owner = std::this_thread::get_id();
+  semaphore->depth = 1;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t semaphore) {
+  {
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    if (semaphore->depth == 0 || semaphore->owner != std::this_thread::get_id()) return pdFALSE;
+    if (--semaphore->depth > 0) return pdTRUE;
+    semaphore->owner = std::thread::id();
+  }
+  return xSemaphoreGive(semaphore);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+  delete semaphore;
+}
+
+struct HostQueue {
+  std::mutex mutex;
+  std::condition_variable cv;
+  UBaseType_t length;
+  UBaseType_t itemSize;
+  std::deque<std::vector<uint8_t>> items;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  HostQueue* queue = new HostQueue;
+  queue->length = length;
+  queue->itemSize = itemSize;
+  return queue;
+}
+
+// waits like xSemaphoreTake, true when ready() holds
+template <typename Ready>
+static bool wait(HostQueue* queue, std::unique_lock<std::mutex>* lock, TickType_t ticks, Ready ready) {
+  if (ticks == portMAX_DELAY) {
+    queue->cv.wait(*lock, ready);
+    return true;
+  }
+  return queue->cv.wait_for(*lock, std::chrono::milliseconds(ticks), ready);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!wait(queue, &lock, ticks, [queue] { return queue->items.size() < queue->length; })) return pdFALSE;
+  const uint8_t* bytes = static_cast<const uint8_t*>(item);
+  queue->items.emplace_back(bytes, bytes + queue->itemSize);
+  queue->cv.notify_all();
+  return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void* item, BaseType_t* woken) {
+  if (woken) *woken = pdFALSE;
+  return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!wait(queue, &lock, ticks, [queue] { return !queue->items.empty(); })) return pdFALSE;
+  memcpy(item, queue->items.front().data(), queue->itemSize);
+  queue->items.pop_front();
+  queue->cv.notify_all();
+  return pdTRUE;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+  delete queue;
+}
+
+struct HostTask {
+  TaskFunction_t function;
+  void* arg;
+};
+
+static void runTask(HostTask* task) {
+  task->function(task->arg);
+  // returning from a task is an error on FreeRTOS
+  fprintf(stderr, "task returned without deleting itself\n");
+  abort();
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stackDepth, void* arg,
+                       UBaseType_t priority, TaskHandle_t* task) {
+  (void)name;
+  (void)stackDepth;
+  (void)priority;
+  HostTask* created = new HostTask{function, arg};
+  std::thread(runTask, created).detach();
+  if (task) *task = created;
+  return pdPASS;
+}
+
+// the handle of a task is not known on its own thread, so vTaskDelete(nullptr)
+// doesn't free it: tasks live as long as the program on the host
+void vTaskDelete(TaskHandle_t task) {
+  if (task) {
+    fprintf(stderr, "host tasks can only delete themselves\n");
+    abort();
+  }
+  pthread_exit(nullptr);
+}
+
+struct HostTimer {
+  std::mutex mutex;
+  std::condition_variable cv;
+  TickType_t period;
+  bool autoReload;
+  void* id;
+  TimerCallbackFunction_t callback;
+  bool running;
+  bool restarted;  // from its own callback
+  bool deleted;
+  std::thread thread;
+};
+
+static void runTimer(HostTimer* timer) {
+  std::unique_lock<std::mutex> lock(timer->mutex);
+  while (!timer->deleted) {
+    TickType_t period = timer->period;
+    if (timer->cv.wait_for(lock, std::chrono::milliseconds(period),
+                           [timer, period] { return timer->deleted || timer->period != period; })) {
+      continue;  // deleted or restarted with a new period
+    }
+    lock.unlock();
+    timer->callback(timer);
+    lock.lock();
+    if (!timer->autoReload && !timer->restarted) break;
+    timer->restarted = false;
+  }
+  timer->running = false;
+}
+
+TimerHandle_t xTimerCreate(const char* name, TickType_t period, UBaseType_t autoReload, void* id,
+                           TimerCallbackFunction_t callback) {
+  (void)name;
+  HostTimer* timer = new HostTimer;
+  timer->period = period;
+  timer->autoReload = autoReload;
+  timer->id = id;
+  timer->callback = callback;
+  timer->running = false;
+  timer->restarted = false;
+  timer->deleted = false;
+  return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks) {
+  (void)ticks;
+  std::lock_guard<std::mutex> lock(timer->mutex);
+  if (timer->running) {
+    if (timer->thread.get_id() == std::this_thread::get_id()) timer->restarted = true;
+    return pdPASS;
+  }
+  if (timer->thread.joinable()) timer->thread.join();
+  timer->running = true;
+  timer->thread = std::thread(runTimer, timer);
+  return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticks) {
+  {
+    std::lock_guard<std::mutex> lock(timer->mutex);
+    timer->period = period;
+    timer->cv.notify_all();
+  }
+  return xTimerStart(timer, ticks);
+}
+
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t ticks) {
+  (void)ticks;
+  {
+    std::lock_guard<std::mutex> lock(timer->mutex);
+    timer->deleted = true;
+    timer->cv.notify_all();
+  }
+  if (timer->thread.joinable()) {
+    if (timer->thread.get_id() == std::this_thread::get_id()) {
+      timer->thread.detach();  // leaks the timer, as deleting from its own callback is rare
+      return pdPASS;
+    }
+    timer->thread.join();
+  }
+  delete timer;
+  return pdPASS;
+}
+
+void* pvTimerGetTimerID(TimerHandle_t timer) {
+  return timer->id;
+}
+
+uint32_t millis() {
+  if (frozen) return frozenMicros / 1000;
+  return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+}
+
+uint32_t micros() {
+  if (frozen) return frozenMicros;
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+}
+
+void delay(uint32_t ms) {
+  if (frozen) {
+    host::advance(ms);
+    return;
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void host::freezeClock() {
+  frozenMicros = micros();
+  frozen = true;
+}
+
+void host::advance(uint32_t ms) {
+  frozenMicros += ms * 1000;
+}
@@ -0,0 +1,295 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+// Replays a traffic capture (see src/TrafficCapture.h) on the host.
+//
+// The recorded byte streams are fed to a MessageParser per connection,
+// chunked exactly as they were received, datagrams are parsed as one
+// frame each, and every parsed request is answered by a stub handler.
+// The requests the parser produces are compared with the ones the
+// device parsed; any difference is reported as a divergence and makes
+// the tool exit with status 1, so captures can be kept as regression
+// benchmarks.
+//
+// Build from this directory, as one command:
+//   g++ -std=gnu++17 -O2 -I../host -I../../src
+//       replay.cpp ../../src/Message.cpp -o replay
+//
+// Usage:
+//   replay <capture> [speed]
+//   speed: 1 replays at the original pace (default), 10 ten times
+//          faster, 0 as fast as possible
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "MessageParser.h"
+#include "Message.h"
+#include "TrafficCapture.h"
+
+using espModbus::MessageParser;
+using espModbus::RequestMessage;
+using espModbus::ResponseMessage;
+namespace capture = espModbus::capture;
+typedef std::chrono::steady_clock Clock;
+
+namespace {
+
+struct Parsed {
+  uint16_t transactionId;
+  uint8_t unitId;
+  uint8_t functionalCode;
+};
+
+struct Stream {
+  MessageParser<RequestMessage*> parser;
+  std::deque<Parsed> parsed;  // not yet matched with a MESSAGE record
+};
+
+struct Statistics {
+  uint64_t records = 0;
+  uint64_t bytes = 0;
+  uint64_t requests = 0;
+  uint64_t latencyTotal = 0;  // ns
+  uint64_t latencyMax = 0;
+  uint64_t divergences = 0;
+  uint64_t lost = 0;
+};
+
+uint8_t zeros[256] = {0};
+
+uint16_t get16(const uint8_t* p) {
+  return p[0] | (p[1] << 8);
+}
+
+uint32_t get32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+void diverge(Statistics* stats, uint8_t connection, uint64_t record, const char* what) {
+  ++stats->divergences;
+  if (stats->divergences <= 10) {
+    printf("divergence in record %llu, connection %u: %s\n",
+           static_cast<unsigned long long>(record), connection, what);
+  }
+}
+
+// answer like a slave that has every address, without copying the
+// payload
+ResponseMessage* handle(const RequestMessage& request) {
+  espModbus::Error error = request.validate();
+  if (error != espModbus::SUCCES) return request.createResponse(error);
+  size_t len = 0;
+  switch (request.functionalCode()) {
+  case espModbus::READ_COILS:
+  case espModbus::READ_DISCR_INPUTS:
+    len = espModbus::coilsToBytes(request.noRegisters());
+    break;
+  case espModbus::READ_HOLD_REGISTERS:
+  case espModbus::READ_INPUT_REGISTERS:
+  case espModbus::READ_WRITE_MULT_REGISTERS:
+    len = espModbus::registersToBytes(request.noRegisters());
+    break;
+  case espModbus::WRITE_COIL:
+  case espModbus::WRITE_HOLD_REGISTER:
+  case espModbus::WRITE_MULT_COILS:
+  case espModbus::WRITE_MULT_REGISTERS:
+    break;
+  default:
+    return request.createResponse(espModbus::ILLEGAL_FUNCTION);
+  }
+  return request.createResponse(espModbus::SUCCES, zeros, len);
+}
+
+// latency counts from the arrival of the bytes
+void serve(Stream* stream, RequestMessage* request, Clock::time_point start, Statistics* stats) {
+  stream->parsed.push_back({request->transactionId(), request->slaveId(), request->functionalCode()});
+  delete handle(*request);
+  delete request;
+  uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+  ++stats->requests;
+  stats->latencyTotal += latency;
+  if (latency > stats->latencyMax) stats->latencyMax = latency;
+}
+
+void feed(Stream* stream, const uint8_t* data, size_t len, Statistics* stats) {
+  Clock::time_point start = Clock::now();
+  uint8_t* d = const_cast<uint8_t*>(data);
+  RequestMessage* request = nullptr;
+  while (true) {
+    size_t parsed = stream->parser.parse(d, len, request);
+    d += parsed;
+    len -= parsed;
+    if (request != nullptr) {
+      serve(stream, request, start, stats);
+      continue;
+    }
+    if (stream->parser.dropped()) continue;
+    if (len == 0 || parsed == 0) break;
+  }
+}
+
+// requests the device didn't see
+void drain(Stream* stream, uint8_t connection, uint64_t record, Statistics* stats) {
+  while (!stream->parsed.empty()) {
+    diverge(stats, connection, record, "request not parsed on the device");
+    stream->parsed.pop_front();
+  }
+}
+
+}  // end namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <capture> [speed]\n", argv[0]);
+    return 2;
+  }
+  double speed = argc > 2 ? atof(argv[2]) : 1.0;
+  FILE* file = fopen(argv[1], "rb");
+  if (!file) {
+    perror(argv[1]);
+    return 2;
+  }
+  std::vector<uint8_t> buffer;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) buffer.insert(buffer.end(), chunk, chunk + n);
+  fclose(file);
+  if (buffer.size() < capture::HEADER_LENGTH ||
+      memcmp(buffer.data(), capture::MAGIC, sizeof(capture::MAGIC)) != 0 ||
+      buffer[4] < 1 || buffer[4] > capture::VERSION) {
+    fprintf(stderr, "%s: not a version 1 to %u capture\n", argv[1], capture::VERSION);
+    return 2;
+  }
+
+  std::map<uint8_t, std::unique_ptr<Stream>> streams;
+  Statistics stats;
+  size_t position = capture::HEADER_LENGTH;
+  bool first = true;
+  uint32_t previous = 0;
+  uint64_t elapsed = 0;  // us, capture time
+  Clock::time_point start = Clock::now();
+  while (position + capture::RECORD_HEADER_LENGTH <= buffer.size()) {
+    const uint8_t* header = &buffer[position];
+    uint8_t type = header[0];
+    uint8_t connection = header[1];
+    size_t len = get16(&header[2]);
+    uint32_t time = get32(&header[4]);
+    const uint8_t* payload = header + capture::RECORD_HEADER_LENGTH;
+    if (position + capture::RECORD_HEADER_LENGTH + len > buffer.size()) {
+      printf("capture truncated in record %llu\n", static_cast<unsigned long long>(stats.records));
+      break;
+    }
+    position += capture::RECORD_HEADER_LENGTH + len;
+    ++stats.records;
+
+    elapsed += first ? 0 : static_cast<uint32_t>(time - previous);  // device clock wraps
+    previous = time;
+    first = false;
+    if (speed > 0) {
+      std::this_thread::sleep_until(start + std::chrono::microseconds(static_cast<uint64_t>(elapsed / speed)));
+    }
+
+    std::unique_ptr<Stream>& stream = streams[connection];
+    switch (type) {
+    case capture::CONNECT:
+      if (stream) drain(stream.get(), connection, stats.records, &stats);
+      stream.reset(new Stream);
+      break;
+    case capture::DATA:
+      if (!stream) stream.reset(new Stream);  // capture started mid connection
+      drain(stream.get(), connection, stats.records, &stats);
+      stats.bytes += len;
+      feed(stream.get(), payload, len, &stats);
+      break;
+    case capture::DATAGRAM:
+      {
+      // nothing carries over from one datagram to the next
+      if (!stream) stream.reset(new Stream);
+      drain(stream.get(), connection, stats.records, &stats);
+      stats.bytes += len;
+      Clock::time_point arrival = Clock::now();
+      RequestMessage* request = MessageParser<RequestMessage*>::parseFrame(payload, len);
+      if (request) serve(stream.get(), request, arrival, &stats);
+      break;
+      }
+    case capture::MESSAGE:
+      if (len < 4) {
+        diverge(&stats, connection, stats.records, "malformed MESSAGE record");
+      } else if (!stream || stream->parsed.empty()) {
+        diverge(&stats, connection, stats.records, "request parsed on the device only");
+      } else {
+        Parsed expected = {get16(payload), payload[2], payload[3]};
+        Parsed actual = stream->parsed.front();
+        stream->parsed.pop_front();
+        if (expected.transactionId != actual.transactionId ||
+            expected.unitId != actual.unitId ||
+            expected.functionalCode != actual.functionalCode) {
+          diverge(&stats, connection, stats.records, "different request");
+        }
+      }
+      break;
+    case capture::DISCONNECT:
+      if (stream) drain(stream.get(), connection, stats.records, &stats);
+      streams.erase(connection);
+      break;
+    case capture::DROPPED:
+      // the streams have a gap, parsers would rightfully disagree
+      stats.lost += len >= 4 ? get32(payload) : 0;
+      streams.clear();
+      break;
+    default:
+      printf("unknown record type %u, stopping\n", type);
+      position = buffer.size();
+      break;
+    }
+  }
+  for (auto& stream : streams) {
+    if (stream.second) drain(stream.second.get(), stream.first, stats.records, &stats);
+  }
+
+  double wall = std::chrono::duration<double>(Clock::now() - start).count();
+  printf("records:      %llu\n", static_cast<unsigned long long>(stats.records));
+  printf("capture time: %.3f s\n", elapsed / 1e6);
+  printf("replay time:  %.3f s\n", wall);
+  printf("bytes:        %llu (%.0f bytes/s)\n", static_cast<unsigned long long>(stats.bytes), stats.bytes / wall);
+  printf("requests:     %llu (%.0f requests/s)\n", static_cast<unsigned long long>(stats.requests), stats.requests / wall);
+  if (stats.requests > 0) {
+    printf("latency:      avg %.2f us, max %.2f us\n",
+           stats.latencyTotal / 1e3 / stats.requests, stats.latencyMax / 1e3);
+  }
+  if (stats.lost > 0) {
+    printf("lost:         %llu bytes not captured\n", static_cast<unsigned long long>(stats.lost));
+  }
+  printf("divergences:  %llu\n", static_cast<unsigned long long>(stats.divergences));
+  return stats.divergences > 0 ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+// A coroutine handler waits for a value that another thread delivers
+// through a Completion. The request must stay unanswered until then, and
+// the resume task must send the reply. A second request finds the value
+// already there and is answered without suspending. Finally the slave is
+// destroyed, which has to stop the resume task.
+//
+// sources: ModbusTCPSlave.cpp Connection.cpp Coroutine.cpp Message.cpp ChangeTracker.cpp TrafficCapture.cpp
+// flags: -std=gnu++20
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include <HostNetwork.h>
+
+#include "ModbusTCPSlave.h"
+
+namespace {
+
+espModbus::Completion<uint16_t> sensor;
+std::atomic<int> suspended(0);
+std::atomic<int> finished(0);
+
+// locals are destroyed after the reply went out
+struct Finish {
+  ~Finish() {
+    ++finished;
+  }
+};
+
+espModbus::Task onRequest(void* arg, const espModbus::Message& request) {
+  (void)arg;
+  (void)request;
+  Finish finish;
+  if (!sensor.await_ready()) ++suspended;
+  uint16_t value = co_await sensor;
+  uint8_t data[2] = {espModbus::high(value), espModbus::low(value)};
+  co_return espModbus::Reply(espModbus::SUCCES, data, sizeof(data));
+}
+
+std::vector<uint8_t> received;
+
+void send(AsyncClient* client, uint16_t transactionId) {
+  uint8_t request[12] = {0, static_cast<uint8_t>(transactionId), 0, 0, 0, 6, 1, 3, 0, 0, 0, 1};
+  client->write(reinterpret_cast<const char*>(request), sizeof(request));
+}
+
+bool waitFinished(int count) {
+  for (int i = 0; i < 1000 && finished < count; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return finished == count;
+}
+
+// the response to transactionId with register value 0x1234
+bool answered(uint16_t transactionId) {
+  const uint8_t expected[11] = {0, static_cast<uint8_t>(transactionId), 0, 0, 0, 5, 1, 3, 2, 0x12, 0x34};
+  return received == std::vector<uint8_t>(expected, expected + sizeof(expected));
+}
+
+}  // end anonymous namespace
+
+int main() {
+  bool ok = true;
+  {
+    ModbusTCPSlave slave(1);
+    slave.onAsyncRequest(onRequest);
+    slave.begin();
+
+    AsyncClient* client = new AsyncClient;
+    client->onData([](void* arg, AsyncClient* c, void* data, size_t len) {
+      (void)arg;
+      (void)c;
+      received.assign(static_cast<uint8_t*>(data), static_cast<uint8_t*>(data) + len);
+    });
+    client->connect(IPAddress(127, 0, 0, 1), 502);
+    while (host::pump()) {}
+
+    send(client, 1);
+    while (host::pump()) {}
+    bool waiting = suspended == 1 && finished == 0 && received.empty();
+    printf("handler suspended: %s\n", waiting ? "ok" : "FAILED");
+    ok = ok && waiting;
+
+    std::thread([] { sensor.complete(0x1234); }).join();
+    // the network isn't thread safe, only pump once the reply is out
+    bool resumed = waitFinished(1);
+    while (host::pump()) {}
+    resumed = resumed && answered(1);
+    printf("resumed by completion: %s\n", resumed ? "ok" : "FAILED");
+    ok = ok && resumed;
+
+    received.clear();
+    send(client, 2);
+    while (host::pump()) {}
+    bool ready = suspended == 1 && finished == 2 && answered(2);
+    printf("completed before co_await: %s\n", ready ? "ok" : "FAILED");
+    ok = ok && ready;
+  }
+  // the destructor returned, so the resume task stopped
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,236 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+// Two clients on one slave with a slow handler. The polite master sends
+// one request at a time and must never be refused.
+//
+// First the flooder pipelines MAX_MODBUS_REQUESTS requests in one
+// segment as soon as the previous ones are answered, so its queue is
+// always full and a service pass ends at MAX_SERVICE_TIME with its
+// requests left over. A polite request arriving behind such a pass must
+// not wait for the flooder's leftovers: at most one flooder request goes
+// before it, so it is answered within the pass in progress plus a few
+// handler times.
+//
+// Then the flooder sends a new burst on every segment it receives,
+// answered or not, which overloads the network task itself. A rate limit
+// on the flooder's address must then keep the polite master going.
+//
+// sources: ModbusTCPSlave.cpp Connection.cpp ModbusTCPMaster.cpp Message.cpp ChangeTracker.cpp TrafficCapture.cpp
+
+#include <cstdio>
+#include <vector>
+
+#include <HostClock.h>
+#include <HostNetwork.h>
+
+#include "ModbusTCPSlave.h"
+#include "ModbusTCPMaster.h"
+
+namespace {
+
+const uint32_t HANDLER_TIME = 8;  // ms
+const uint32_t DURATION = 2000;  // ms
+
+struct Counts {
+  uint32_t ok;
+  uint32_t busy;
+  uint32_t other;
+  uint32_t maxLatency;  // ms
+  uint64_t totalLatency;
+};
+
+void onRequest(void* arg, const espModbus::Connection& connection) {
+  (void)arg;
+  delay(HANDLER_TIME);
+  uint8_t data[2] = {0, 1};
+  connection.respond(espModbus::SUCCES, data, sizeof(data));
+}
+
+// raw client: answers every segment with a new burst of requests
+class Flooder {
+ public:
+  Flooder() :
+    counts(),
+    running(false),
+    _client(),
+    _transactionId(0),
+    _pipelined(true),
+    _outstanding(0) {
+      _client.onConnect([](void* arg, AsyncClient* client) {
+        (void)client;
+        static_cast<Flooder*>(arg)->_burst();
+      }, this);
+      _client.onData([](void* arg, AsyncClient* client, void* data, size_t len) {
+        (void)client;
+        static_cast<Flooder*>(arg)->_onData(static_cast<uint8_t*>(data), len);
+      }, this);
+  }
+  void connect() {
+    _client.connect(IPAddress(127, 0, 0, 1), 502);
+  }
+  void disconnect() {
+    _client.close();
+  }
+  void start(bool pipelined) {
+    counts = Counts();
+    running = true;
+    _pipelined = pipelined;
+    _outstanding = 0;
+    _burst();
+  }
+
+  Counts counts;
+  bool running;
+
+ private:
+  void _burst() {
+    if (!running || (_pipelined && _outstanding > 0)) return;
+    _outstanding += MAX_MODBUS_REQUESTS;
+    for (size_t i = 0; i < MAX_MODBUS_REQUESTS; ++i) {
+      uint16_t id = _transactionId++;
+      uint8_t request[12] = {static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id), 0, 0, 0, 6, 1, 3, 0, 0, 0, 1};
+      _client.add(reinterpret_cast<const char*>(request), sizeof(request));
+    }
+    _client.send();
+  }
+  void _onData(const uint8_t* data, size_t len) {
+    while (len >= 9) {
+      size_t frame = 6 + (data[4] << 8 | data[5]);
+      if (data[7] == 3) {
+        ++counts.ok;
+      } else if (data[7] == 0x83 && data[8] == espModbus::SERVER_DEVICE_BUSY) {
+        ++counts.busy;
+      } else {
+        ++counts.other;
+      }
+      if (_outstanding > 0) --_outstanding;
+      data += frame;
+      len -= std::min(frame, len);
+    }
+    _burst();
+  }
+
+  AsyncClient _client;
+  uint16_t _transactionId;
+  bool _pipelined;
+  size_t _outstanding;
+};
+
+struct Polite {
+  ModbusTCPMaster* master;
+  Counts counts;
+  bool running;
+};
+
+// the request address carries the time it was issued
+void onResponse(void* arg, espModbus::Error error, const espModbus::Message& request,
+                const espModbus::ResponseMessage* response) {
+  (void)response;
+  Polite* polite = static_cast<Polite*>(arg);
+  uint32_t latency = static_cast<uint16_t>(millis() - request.address());
+  if (error == espModbus::SUCCES) {
+    ++polite->counts.ok;
+    if (latency > polite->counts.maxLatency) polite->counts.maxLatency = latency;
+    polite->counts.totalLatency += latency;
+  } else if (error == espModbus::SERVER_DEVICE_BUSY) {
+    ++polite->counts.busy;
+  } else {
+    ++polite->counts.other;
+  }
+  if (polite->running) polite->master->readHoldingRegisters(1, millis(), 1, onResponse, polite, 5000);
+}
+
+void print(const char* name, const Counts& c) {
+  printf("  %s: %u ok, %u busy, %u other", name, c.ok, c.busy, c.other);
+  if (c.ok && c.maxLatency) printf(", latency avg %u ms, max %u ms", static_cast<uint32_t>(c.totalLatency / c.ok), c.maxLatency);
+  printf("\n");
+}
+
+void run(const char* name, Polite* polite, Flooder* flooder, bool pipelined = true) {
+  polite->counts = Counts();
+  polite->running = true;
+  polite->master->readHoldingRegisters(1, millis(), 1, onResponse, polite, 5000);
+  if (flooder) flooder->start(pipelined);
+  uint32_t start = millis();
+  while (millis() - start < DURATION) {
+    if (!host::pump()) {
+      host::poll();
+      host::advance(1);
+    }
+  }
+  polite->running = false;
+  if (flooder) flooder->running = false;
+  while (host::pump()) {}
+  printf("%s\n", name);
+  print("polite", polite->counts);
+  if (flooder) print("flooder", flooder->counts);
+}
+
+}  // end anonymous namespace
+
+int main() {
+  host::freezeClock();  // handlers advance it, same result on every run
+  ModbusTCPSlave slave(1);
+  slave.onRequest(onRequest);
+  slave.begin();
+
+  host::setLocalIP(IPAddress(10, 0, 0, 1));
+  Flooder flooder;
+  flooder.connect();
+  host::setLocalIP(IPAddress(10, 0, 0, 2));
+  ModbusTCPMaster master(IPAddress(127, 0, 0, 1));
+  master.setMaxInFlight(1);
+  master.connect();
+  while (host::pump()) {}
+  Polite polite = {&master, Counts(), false};
+
+  run("polite master alone", &polite, nullptr);
+  Counts alone = polite.counts;
+
+  run("pipelining flooder", &polite, &flooder);
+  Counts flooded = polite.counts;
+  // the pass in progress (overrunning by one handler), one flooder
+  // request, its own, and the rest of the pass before the flush
+  const uint32_t bound = MAX_SERVICE_TIME + 4 * HANDLER_TIME;
+  bool ok = flooded.busy == 0 && flooded.other == 0;
+  ok = ok && flooded.maxLatency <= bound;
+  ok = ok && flooded.ok * bound * 10 >= DURATION * 8;
+
+  slave.setRateLimit(IPAddress(10, 0, 0, 1), 20, 5);
+  flooder.disconnect();  // a new connection picks up the limit
+  while (host::pump()) {}
+  host::setLocalIP(IPAddress(10, 0, 0, 1));
+  flooder.connect();
+  while (host::pump()) {}
+  run("unbounded flooder limited to 20 requests/s", &polite, &flooder, false);
+  Counts limited = polite.counts;
+  ok = ok && limited.busy == 0 && limited.other == 0;
+  ok = ok && flooder.counts.busy > flooder.counts.ok && flooder.counts.ok <= 20 * DURATION / 1000 + 5;
+  ok = ok && limited.ok * 10 >= alone.ok * 7;
+
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+// Crash consistency of MappedRegisters: a child process writes the
+// registers and dies without end(), before or after flush(), or is
+// killed while writing. The parent reopens the file and checks every
+// register the child reported as written.
+//
+// sources: MappedRegisters.cpp
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "MappedRegisters.h"
+
+using espModbus::MappedRegisters;
+
+namespace {
+
+const uint16_t ADDRESS = 0;
+const uint16_t NUMBER_REGISTERS = 5000;  // several pages
+char path[] = "/tmp/mappedXXXXXX";
+
+uint16_t pattern(uint16_t address, uint16_t round) {
+  return address * 7 + round;
+}
+
+enum Crash {
+  BEFORE_FLUSH,
+  AFTER_FLUSH,
+  KILLED
+};
+
+// child: write all registers through the network side, then crash
+void child(Crash crash, uint16_t round, int report) {
+  MappedRegisters registers(path, ADDRESS, NUMBER_REGISTERS, 60000);  // no timed flush
+  if (!registers.begin()) _exit(2);
+  for (uint16_t address = ADDRESS; address < ADDRESS + NUMBER_REGISTERS; ++address) {
+    uint16_t value = pattern(address, round);
+    uint8_t data[2] = {static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value)};
+    if (registers.write(1, address, 1, data) != espModbus::SUCCES) _exit(3);
+  }
+  if (crash == AFTER_FLUSH) registers.flush();
+  if (crash == KILLED) {
+    char done = 1;
+    if (write(report, &done, 1) != 1) _exit(4);
+    while (true) pause();  // parent kills us
+  }
+  _exit(0);  // no destructor, no end()
+}
+
+bool check(const char* name, uint16_t round) {
+  MappedRegisters registers(path, ADDRESS, NUMBER_REGISTERS);
+  if (!registers.begin()) {
+    printf("%s: reopen failed\n", name);
+    return false;
+  }
+  size_t wrong = 0;
+  uint8_t data[250];
+  for (uint16_t address = ADDRESS; address < ADDRESS + NUMBER_REGISTERS; address += 125) {
+    if (registers.read(1, address, 125, data) != espModbus::SUCCES) {
+      printf("%s: read failed\n", name);
+      return false;
+    }
+    for (uint16_t i = 0; i < 125; ++i) {
+      uint16_t value = data[i * 2] << 8 | data[i * 2 + 1];
+      if (value != pattern(address + i, round)) ++wrong;
+    }
+  }
+  registers.end();
+  printf("%s: %zu of %d registers wrong\n", name, wrong, NUMBER_REGISTERS);
+  return wrong == 0;
+}
+
+bool run(const char* name, Crash crash, uint16_t round) {
+  int report[2];
+  if (pipe(report) != 0) return false;
+  pid_t pid = fork();
+  if (pid < 0) return false;
+  if (pid == 0) {
+    close(report[0]);
+    child(crash, round, report[1]);
+  }
+  close(report[1]);
+  if (crash == KILLED) {
+    char done = 0;
+    if (read(report[0], &done, 1) != 1) {
+      printf("%s: child died early\n", name);
+      return false;
+    }
+    kill(pid, SIGKILL);
+  }
+  close(report[0]);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  if (crash != KILLED && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+    printf("%s: child failed with status %d\n", name, status);
+    return false;
+  }
+  return check(name, round);
+}
+
+}  // end anonymous namespace
+
+int main() {
+  int fd = mkstemp(path);
+  if (fd < 0) return 1;
+  close(fd);
+  unlink(path);  // begin() creates a fresh file
+  bool ok = run("exit before flush", BEFORE_FLUSH, 1);
+  ok = run("exit after flush", AFTER_FLUSH, 2) && ok;
+  ok = run("killed after writes", KILLED, 3) && ok;
+  unlink(path);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Builds every test in this directory against the host shims in ../host
+# and runs it. A test lists the library sources it needs on a line
+# starting with "// sources:" and can add compiler flags on a line
+# starting with "// flags:".
+#
+# Usage: ./run.sh [test ...]
+# Compiler and flags can be set with CXX and CXXFLAGS.
+
+cd "$(dirname "$0")" || exit 1
+CXX=${CXX:-g++}
+FLAGS="-std=gnu++17 -O2 -Wall -pthread -DARDUINO -I../host -I../../src $CXXFLAGS"
+BUILD=${BUILD:-build}
+mkdir -p "$BUILD"
+
+tests="$*"
+[ -n "$tests" ] || tests=$(ls *.cpp | sed 's/\.cpp$//')
+failed=0
+for name in $tests; do
+  sources=""
+  for source in $(sed -n 's|^// sources: ||p' "$name.cpp"); do
+    sources="$sources ../../src/$source"
+  done
+  flags=$(sed -n 's|^// flags: ||p' "$name.cpp")
+  echo "== $name"
+  if ! $CXX $FLAGS $flags "$name.cpp" $sources ../host/*.cpp -o "$BUILD/$name"; then
+    failed=1
+    continue
+  fi
+  "$BUILD/$name" || { echo "FAILED: $name"; failed=1; }
+done
+exit $failed
@@ -0,0 +1,138 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+// One writer and several readers hammer a SnapshotRegisters. Every
+// update writes a 64 bit counter to registers 0 - 3 and its complement
+// to registers 4 - 7, so a reader that sees half of an update finds a
+// mismatch. Readers also check that the counter never goes back.
+//
+// sources: SnapshotRegisters.cpp
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "SnapshotRegisters.h"
+
+using espModbus::SnapshotRegisters;
+
+namespace {
+
+const uint16_t ADDRESS = 100;
+const size_t READERS = 4;
+const uint32_t DURATION = 2000;  // ms
+
+std::atomic<bool> running(true);
+std::atomic<bool> failed(false);
+
+void fail(const char* what, uint64_t value) {
+  fprintf(stderr, "torn read: %s %llu\n", what, static_cast<unsigned long long>(value));
+  failed = true;
+  running = false;
+}
+
+uint64_t decode(const uint8_t* data) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < 8; ++i) value = value << 8 | data[i];
+  return value;
+}
+
+void writer(SnapshotRegisters* registers, uint64_t* updates) {
+  uint64_t counter = 0;
+  uint16_t words[8];
+  while (running) {
+    ++counter;
+    for (size_t i = 0; i < 4; ++i) {
+      words[i] = counter >> (48 - i * 16);
+      words[i + 4] = ~words[i];
+    }
+    switch (counter % 3) {
+      case 0:
+        registers->beginUpdate();
+        for (size_t i = 0; i < 8; ++i) registers->set(ADDRESS + i, words[i]);
+        registers->commit();
+        break;
+      case 1:
+        registers->publish(ADDRESS, 8, words);
+        break;
+      default:
+        {
+        uint8_t data[16];
+        for (size_t i = 0; i < 8; ++i) {
+          data[i * 2] = words[i] >> 8;
+          data[i * 2 + 1] = words[i];
+        }
+        while (registers->write(1, ADDRESS, 8, data) != espModbus::SUCCES) {}
+        }
+    }
+  }
+  *updates = counter;
+}
+
+void reader(SnapshotRegisters* registers, uint64_t* reads) {
+  uint64_t last = 0;
+  uint64_t count = 0;
+  uint8_t data[16];
+  while (running) {
+    if (registers->read(1, ADDRESS, 8, data) != espModbus::SUCCES) {
+      fail("read failed", count);
+      return;
+    }
+    uint64_t value = decode(data);
+    uint64_t complement = decode(&data[8]);
+    if (complement != ~value) fail("value and complement differ at", value);
+    if (value < last) fail("counter went back to", value);
+    last = value;
+    ++count;
+  }
+  *reads = count;
+}
+
+}  // end anonymous namespace
+
+int main(int argc, char* argv[]) {
+  uint32_t duration = (argc > 1) ? atoi(argv[1]) : DURATION;
+  SnapshotRegisters registers(ADDRESS, 8);
+  // start consistent: counter 0 and its complement
+  uint16_t words[8] = {0, 0, 0, 0, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF};
+  registers.publish(ADDRESS, 8, words);
+
+  uint64_t updates = 0;
+  std::vector<uint64_t> reads(READERS, 0);
+  std::vector<std::thread> threads;
+  threads.emplace_back(writer, &registers, &updates);
+  for (size_t i = 0; i < READERS; ++i) threads.emplace_back(reader, &registers, &reads[i]);
+  std::this_thread::sleep_for(std::chrono::milliseconds(duration));
+  running = false;
+  for (std::thread& thread : threads) thread.join();
+
+  uint64_t total = 0;
+  for (uint64_t r : reads) total += r;
+  printf("%llu updates, %llu reads by %zu readers\n",
+         static_cast<unsigned long long>(updates), static_cast<unsigned long long>(total), READERS);
+  return failed ? 1 : 0;
+}
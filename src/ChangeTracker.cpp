@@ -0,0 +1,117 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include "ChangeTracker.h"
+
+#include <cstring>  // for memset
+
+namespace espModbus {
+
+ChangeSet::ChangeSet(uint16_t address, uint16_t noRegisters, uint32_t* bits, size_t count) :
+  _address(address),
+  _noRegisters(noRegisters),
+  _bits(bits),
+  _count(count),
+  _position(0) {}
+
+bool ChangeSet::next(uint16_t* address, uint16_t* noRegisters) {
+  // skip unchanged words at once
+  while (_position < _noRegisters && (_bits[_position / 32] >> (_position % 32)) == 0) {
+    _position = (_position / 32 + 1) * 32;
+  }
+  if (_position >= _noRegisters) return false;
+  _position += __builtin_ctz(_bits[_position / 32] >> (_position % 32));
+  uint32_t first = _position;
+  while (_position < _noRegisters && (_bits[_position / 32] & (1UL << (_position % 32)))) {
+    ++_position;
+  }
+  *address = _address + first;
+  *noRegisters = _position - first;
+  return true;
+}
+
+size_t ChangeSet::count() const {
+  return _count;
+}
+
+ChangeTracker::ChangeTracker(uint16_t address, uint16_t noRegisters, uint32_t interval, size_t batchSize) :
+  _address(address),
+  _noRegisters(noRegisters),
+  _interval(interval),
+  _batchSize(batchSize),
+  _words((noRegisters + 31) / 32),
+  _bits{nullptr, nullptr},
+  _count(0),
+  _lastDelivery(0),
+  _onChangeCb(nullptr),
+  _arg(nullptr) {
+    _bits[0] = new uint32_t[_words];
+    _bits[1] = new uint32_t[_words];
+    memset(_bits[0], 0, _words * sizeof(uint32_t));
+    memset(_bits[1], 0, _words * sizeof(uint32_t));
+}
+
+ChangeTracker::~ChangeTracker() {
+  delete[] _bits[0];
+  delete[] _bits[1];
+}
+
+void ChangeTracker::onChange(OnChangeCb callback, void* arg) {
+  _onChangeCb = callback;
+  _arg = arg;
+}
+
+void ChangeTracker::mark(uint16_t address, uint16_t noRegisters) {
+  // only the part inside the tracked window
+  uint32_t first = address > _address ? address : _address;
+  uint32_t last = static_cast<uint32_t>(address) + noRegisters;
+  if (last > static_cast<uint32_t>(_address) + _noRegisters) last = static_cast<uint32_t>(_address) + _noRegisters;
+  for (uint32_t i = first - _address; i + _address < last; ++i) {
+    uint32_t mask = 1UL << (i % 32);
+    if (!(_bits[0][i / 32] & mask)) {
+      _bits[0][i / 32] |= mask;
+      ++_count;
+    }
+  }
+}
+
+uint32_t ChangeTracker::interval() const {
+  return _interval;
+}
+
+void ChangeTracker::deliver(bool force) {
+  if (_count == 0 || !_onChangeCb) return;
+  if (!force && _count < _batchSize && millis() - _lastDelivery < _interval) return;
+  uint32_t* delivering = _bits[0];
+  _bits[0] = _bits[1];
+  _bits[1] = delivering;
+  ChangeSet changes(_address, _noRegisters, delivering, _count);
+  _count = 0;
+  _lastDelivery = millis();
+  _onChangeCb(_arg, changes);
+  memset(delivering, 0, _words * sizeof(uint32_t));
+}
+
+}  // end namespace espModbus
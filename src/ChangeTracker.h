@@ -0,0 +1,108 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stdint.h>  // for uint*_t
+#include <stddef.h>  // for size_t
+#include <functional>  // std::function
+
+#include <esp32-hal.h>  // millis()
+
+#include "Config.h"
+
+#ifndef CHANGE_INTERVAL
+#define CHANGE_INTERVAL 100  // ms
+#endif
+
+#ifndef CHANGE_BATCH_SIZE
+#define CHANGE_BATCH_SIZE 64  // registers or coils
+#endif
+
+namespace espModbus {
+
+class ChangeSet;
+#if MODBUS_STATIC_ALLOCATION
+typedef void (*OnChangeCb)(void*, ChangeSet&);
+#else
+typedef std::function<void(void*, ChangeSet&)> OnChangeCb;
+#endif
+
+// Changed addresses of one notification, walked as contiguous ranges:
+//
+//   uint16_t address, noRegisters;
+//   while (changes.next(&address, &noRegisters)) { ... }
+class ChangeSet {
+  friend class ChangeTracker;
+
+ public:
+  bool next(uint16_t* address, uint16_t* noRegisters);
+  size_t count() const;
+
+ private:
+  ChangeSet(uint16_t address, uint16_t noRegisters, uint32_t* bits, size_t count);
+
+  uint16_t _address;
+  uint16_t _noRegisters;
+  uint32_t* _bits;
+  size_t _count;
+  uint32_t _position;
+};
+
+// Records addresses written by masters in a bitmap and notifies the
+// application in batches: at most once per interval, or as soon as
+// batchSize addresses changed. A master hammering the same register
+// results in a single range per notification.
+// Notifications are delivered by the slave after it handled network
+// traffic, or from its timer once the interval passed, never from within
+// a request handler.
+class ChangeTracker {
+ public:
+  ChangeTracker(uint16_t address, uint16_t noRegisters,
+                uint32_t interval = CHANGE_INTERVAL,
+                size_t batchSize = CHANGE_BATCH_SIZE);
+  ~ChangeTracker();
+  void onChange(OnChangeCb callback, void* arg = nullptr);
+  void mark(uint16_t address, uint16_t noRegisters);
+  void deliver(bool force = false);
+  uint32_t interval() const;
+
+ private:
+  ChangeTracker(const ChangeTracker&) = delete;
+  ChangeTracker& operator=(const ChangeTracker&) = delete;
+
+  uint16_t _address;
+  uint16_t _noRegisters;
+  uint32_t _interval;
+  size_t _batchSize;
+  size_t _words;
+  uint32_t* _bits[2];  // recording, delivering
+  size_t _count;
+  uint32_t _lastDelivery;
+  OnChangeCb _onChangeCb;
+  void* _arg;
+};
+
+}  // end namespace espModbus
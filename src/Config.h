@@ -0,0 +1,133 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#pragma once
+
+// unit: times 500ms
+#ifndef CLIENT_KEEPALIVE
+#define CLIENT_KEEPALIVE 120
+#endif
+
+#ifndef MAX_MODBUS_CLIENTS
+#define MAX_MODBUS_CLIENTS 3
+#endif
+
+#ifndef MAX_MODBUS_REQUESTS
+#define MAX_MODBUS_REQUESTS 5
+#endif
+
+// number of per client rate limits that can be set
+#ifndef MAX_RATE_LIMITS
+#define MAX_RATE_LIMITS 8
+#endif
+
+// Pending requests are served by priority class, 0 being the highest.
+// A request gains one class every PRIORITY_AGING ms it waits, so low
+// priority work can't starve.
+#ifndef MODBUS_PRIORITY_CLASSES
+#define MODBUS_PRIORITY_CLASSES 3
+#endif
+
+// unit: ms
+#ifndef PRIORITY_AGING
+#define PRIORITY_AGING 100
+#endif
+
+// number of unit id and client priority rules that can be set
+#ifndef MAX_PRIORITY_RULES
+#define MAX_PRIORITY_RULES 8
+#endif
+
+// unit: ms, time after which serving pending requests is interrupted to
+// let new requests in. Remaining requests continue on the next receive,
+// ack or poll of any connection. 0 serves everything at once
+#ifndef MAX_SERVICE_TIME
+#define MAX_SERVICE_TIME 20
+#endif
+
+// master: requests a ModbusTCPMaster keeps, in flight or waiting
+#ifndef MAX_MASTER_TRANSACTIONS
+#define MAX_MASTER_TRANSACTIONS 16
+#endif
+
+// unit: ms, master: default time a request may take, counted from the
+// moment it is issued
+#ifndef MASTER_TIMEOUT
+#define MASTER_TIMEOUT 1000
+#endif
+
+// unit: ms, master: how often timeouts are checked, also while not connected
+#ifndef MASTER_TIMEOUT_CHECK
+#define MASTER_TIMEOUT_CHECK 100
+#endif
+
+// master: units with their own limits in a PollPlan
+#ifndef MAX_PLAN_LIMITS
+#define MAX_PLAN_LIMITS 16
+#endif
+
+// unit: ms, maximum time a response is held back to be sent together
+// with the other responses of the same batch. 0 disables coalescing
+#ifndef MAX_COALESCE_DELAY
+#define MAX_COALESCE_DELAY 10
+#endif
+
+// Static allocation profile: connections and messages come from fixed
+// pools sized by the macros above and callbacks are plain function
+// pointers, so nothing is allocated on the heap after begin().
+// Set MODBUS_MEMORY_BUDGET (bytes) to have the footprint checked at
+// compile time.
+#ifndef MODBUS_STATIC_ALLOCATION
+#define MODBUS_STATIC_ALLOCATION 0
+#endif
+
+// number of coroutine handlers that can be suspended at the same time
+#ifndef MAX_MODBUS_COROUTINES
+#define MAX_MODBUS_COROUTINES (MAX_MODBUS_CLIENTS * MAX_MODBUS_REQUESTS)
+#endif
+
+// task resuming coroutine handlers when their completion comes in
+#ifndef COROUTINE_TASK_STACK
+#define COROUTINE_TASK_STACK 4096
+#endif
+#ifndef COROUTINE_TASK_PRIORITY
+#define COROUTINE_TASK_PRIORITY 3
+#endif
+
+// number of messages that can exist at the same time: every connection
+// and the UDP listener can hold MAX_MODBUS_REQUESTS requests, a suspended
+// coroutine handler keeps its request after leaving the queue, plus the
+// request being parsed and the response being sent.
+// When the pool runs out anyway, requests are answered SERVER_DEVICE_BUSY.
+#ifndef MAX_MODBUS_MESSAGES
+#if defined(__cpp_impl_coroutine)
+#define MAX_MODBUS_MESSAGES ((MAX_MODBUS_CLIENTS + 1) * MAX_MODBUS_REQUESTS + MAX_MODBUS_COROUTINES + 2)
+#else
+#define MAX_MODBUS_MESSAGES ((MAX_MODBUS_CLIENTS + 1) * MAX_MODBUS_REQUESTS + 2)
+#endif
+#endif
+
+// 7 MBAP + 253 PDU
+#define MAX_ADU_LENGTH 260
@@ -27,18 +27,66 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 namespace espModbus {
 
+#if MODBUS_STATIC_ALLOCATION
+static ConnectionPool connectionPool;
+
+void* Connection::operator new(size_t size) noexcept {
+  return connectionPool.allocate(size);
+}
+
+void Connection::operator delete(void* p) {
+  connectionPool.release(p);
+}
+#endif
+
 Connection::Connection(ModbusTCPSlave* slave, AsyncClient* client) :
   _slave(slave),
   _client(client),
+  _udp(nullptr),
+  _peer(),
+  _id(0),
   _factory(),
   _currentRequest(nullptr),
-  _keepaliveCount(0) {
-    _client->onPoll(_onPoll, this);
-    _client->onData(_onData, this);
-    _client->onDisconnect(_onDisconnect, this);
+  _queue(),
+  _received(),
+  _numberReceived(0),
+  _bucket(),
+  _clientPriority(-1),
+  _lastServed(micros()),
+  _keepaliveCount(0),
+  _coalescing(false),
+  _pendingBytes(0),
+  _pendingSince(0) {
+#if defined(__cpp_impl_coroutine)
+    for (size_t i = 0; i < MAX_MODBUS_REQUESTS; ++i) _coroutines[i] = nullptr;
+    _currentSince = 0;
+    _currentPriority = 0;
+#endif
+    if (_client) {
+      _client->onPoll(_onPoll, this);
+      _client->onAck(_onAck, this);
+      _client->onData(_onData, this);
+      _client->onDisconnect(_onDisconnect, this);
+    }
+  }
+
+Connection::Connection(ModbusTCPSlave* slave, AsyncUDP* udp) :
+  Connection(slave, static_cast<AsyncClient*>(nullptr)) {
+    _udp = udp;
+    _id = MAX_MODBUS_CLIENTS;
+    _udp->onPacket(_onPacket, this);
   }
 
 Connection::~Connection() {
+  for (size_t i = 0; i < MAX_MODBUS_REQUESTS; ++i) {
+    delete _queue[i].request;
+  }
+#if defined(__cpp_impl_coroutine)
+  // suspended handlers run to completion, their reply is dropped
+  for (size_t i = 0; i < MAX_MODBUS_REQUESTS; ++i) {
+    if (_coroutines[i]) _coroutines[i]->_connection = nullptr;
+  }
+#endif
   delete _client;
 }
 
@@ -47,51 +95,363 @@ const Message& Connection::request() const {
 }
 
 bool Connection::respond(Error error, uint8_t* data, size_t len) const {
-  bool result = false;
-  ResponseMessage* response = _currentRequest->createResponse(error, data, len);
-  log_v("sending message, len %d", response->length());
-  if (_client->space() > response->length()) {
-    _client->write(reinterpret_cast<const char*>(response->data()), response->length());
-    log_v("sent!");
-    result = true;
-  } else {
-    log_e("unable to send");
+  return _respond(*_currentRequest, error, data, len);
+}
+
+bool Connection::_respond(const RequestMessage& request, Error error, uint8_t* data, size_t len) const {
+  ResponseMessage* response = request.createResponse(error, data, len);
+  if (!response) {
+    log_e("out of memory, answering busy");
+    _respondBusy(request.data(), _peerOf(request));
+    return false;
   }
+  if (error == SUCCES) _slave->_onWritten(request);
+  log_v("sending message, len %d", response->length());
+  bool result = _send(response->data(), response->length(), _peerOf(request));
   delete response;
   return result;
 }
 
+// for when there is no memory for a message: the exception is built from
+// the request's header, nothing is allocated
+void Connection::_respondBusy(const uint8_t* header, const Peer& peer) const {
+  uint8_t response[9] = {header[0], header[1], 0, 0, 0, 3, header[6], static_cast<uint8_t>(header[7] | 0x80), SERVER_DEVICE_BUSY};
+  _send(response, sizeof(response), peer);
+}
+
+bool Connection::_send(const uint8_t* data, size_t len, const Peer& peer) const {
+  if (_udp) {
+    if (_udp->writeTo(data, len, peer.ip, peer.port) != len) {
+      log_e("unable to send");
+      return false;
+    }
+    ++(_slave->_packetCount);
+    return true;
+  }
+  if (_client->space() <= len) {
+    log_e("unable to send");
+    return false;
+  }
+  // responses are only queued here, they go out in one segment on _flush()
+  _client->add(reinterpret_cast<const char*>(data), len);
+  if (_pendingBytes == 0) _pendingSince = millis();
+  _pendingBytes += len;
+  if (_coalescing) {
+    _flushOverdue();
+  } else {
+    _flush();
+  }
+  log_v("queued!");
+  return true;
+}
+
 void Connection::_onData(void* conn, AsyncClient* client, void* data, size_t len) {
   log_v("data rx - len: %d", len);
   Connection* c = static_cast<Connection*>(conn);
+  xSemaphoreTakeRecursive(c->_slave->_lock, portMAX_DELAY);
   c->_keepaliveCount = 0;
+  c->_coalescing = (MAX_COALESCE_DELAY > 0);
+  c->_numberReceived = 0;
+  uint8_t* d = static_cast<uint8_t*>(data);
+  c->_record(capture::DATA, d, len);
   size_t parsed = 0;
-  while (len > 0) {
-    parsed = c->_factory.parse(static_cast<uint8_t*>(data), len, c->_currentRequest);
-    len = len - parsed;
+  while (true) {
+    parsed = c->_factory.parse(d, len, c->_currentRequest);
+    d += parsed;
+    len -= parsed;
     log_v("parsed: %d", parsed);
     if (c->_currentRequest != nullptr) {
-      c->_slave->_onRequest(*c);
-      delete c->_currentRequest;
-      c->_currentRequest = nullptr;
+      c->_recordRequest();
+      c->_accept();
+      continue;  // parser may hold more pipelined requests
+    }
+    if (c->_factory.dropped()) {
+      ++(c->_slave->_requestCount);
+      c->_respondBusy(c->_factory.dropped(), c->_peer);
+      continue;
+    }
+    if (len == 0 || parsed == 0) break;
+  }
+  if (c->_slave->_onBatchCb) c->_serveBatch();
+  c->_slave->_service();
+  c->_slave->_deliverChanges();
+  xSemaphoreGiveRecursive(c->_slave->_lock);
+}
+
+// every datagram carries exactly one request
+void Connection::_onPacket(void* conn, AsyncUDPPacket& packet) {  // NOLINT (non const reference)
+  log_v("datagram rx - len: %d", packet.length());
+  Connection* c = static_cast<Connection*>(conn);
+  xSemaphoreTakeRecursive(c->_slave->_lock, portMAX_DELAY);
+  c->_record(capture::DATAGRAM, packet.data(), packet.length());
+  c->_numberReceived = 0;
+  c->_currentRequest = MessageParser<RequestMessage*>::parseFrame(packet.data(), packet.length());
+  if (c->_currentRequest) {
+    c->_peer = {packet.remoteIP(), packet.remotePort()};
+    c->_recordRequest();
+    c->_accept();
+  } else if (MessageParser<RequestMessage*>::isFrame(packet.data(), packet.length())) {
+    c->_peer = {packet.remoteIP(), packet.remotePort()};
+    ++(c->_slave->_requestCount);
+    c->_respondBusy(packet.data(), c->_peer);
+  } else {
+    log_w("invalid datagram");
+  }
+  if (c->_slave->_onBatchCb) c->_serveBatch();
+  c->_slave->_service();
+  // no acks to continue with on UDP: the timer serves what the pass left
+  // over, without holding up the UDP task
+  if (c->_pending()) xTimerStart(c->_slave->_udpTimer, 0);
+  c->_slave->_deliverChanges();
+  xSemaphoreGiveRecursive(c->_slave->_lock);
+}
+
+// queue the parsed request or reject it right away
+void Connection::_accept() {
+  ++(_slave->_requestCount);
+  TokenBucket* bucket = &_bucket;
+  int16_t clientPriority = _clientPriority;
+  if (_udp) {
+    // rules for the sender of this datagram
+    TokenBucket* peerBucket = _slave->_datagramBucket(_peer.ip);
+    if (peerBucket) bucket = peerBucket;
+    clientPriority = _slave->_clientPriority(_peer.ip);
+  }
+  Error error = _currentRequest->validate();
+  if (error != SUCCES) {
+    log_w("invalid request: %d", error);
+  } else if (!bucket->take(millis())) {
+    log_w("rate limit exceeded");
+    error = SERVER_DEVICE_BUSY;
+  } else {
+    error = SERVER_DEVICE_BUSY;
+    for (size_t i = 0; i < MAX_MODBUS_REQUESTS; ++i) {
+      if (!_queue[i].request) {
+        _queue[i].request = _currentRequest;
+        _queue[i].since = micros();
+        _queue[i].priority = _slave->_priority(*_currentRequest, clientPriority);
+        _queue[i].peer = _peer;
+        _received[_numberReceived++] = i;
+        error = SUCCES;
+        break;
+      }
+    }
+    if (error != SUCCES) {
+      log_w("too many pending requests");
     }
   }
+  if (error != SUCCES) {
+    respond(error);
+    delete _currentRequest;
+  }
+  _currentRequest = nullptr;
+}
+
+bool Connection::_pending() const {
+  for (size_t i = 0; i < MAX_MODBUS_REQUESTS; ++i) {
+    if (_queue[i].request) return true;
+  }
+  return false;
+}
+
+// Pending request with the best (lowest) score, aged from its arrival so
+// a low class request overtakes the higher classes queued after it.
+bool Connection::_next(uint32_t now, int32_t* score, size_t* index) const {
+  bool found = false;
+  for (size_t i = 0; i < MAX_MODBUS_REQUESTS; ++i) {
+    if (!_queue[i].request) continue;
+    int32_t s = static_cast<int32_t>(_queue[i].priority) * PRIORITY_AGING * 1000 - static_cast<int32_t>(now - _queue[i].since);
+    if (!found || s < *score || (s == *score && _queue[i].since < _queue[*index].since)) {
+      *score = s;
+      *index = i;
+      found = true;
+    }
+  }
+  return found;
+}
+
+void Connection::_serve(size_t index) {
+  _currentRequest = _queue[index].request;
+  uint32_t since = _queue[index].since;
+  uint8_t priority = _queue[index].priority;
+  _peer = _queue[index].peer;
+  _queue[index].request = nullptr;
+  _lastServed = micros();
+#if defined(__cpp_impl_coroutine)
+  _currentSince = since;
+  _currentPriority = priority;
+#endif
+  _slave->_onRequest(*this);
+  // taken by a coroutine handler: latency is recorded at its reply
+  bool answered = _currentRequest != nullptr;
+  delete _currentRequest;
+  _currentRequest = nullptr;
+  if (answered) _slave->_recordLatency(priority, since);
+}
+
+// hand the requests of this receive to the batch handler, the ones it
+// leaves unanswered stay queued for the scheduler
+void Connection::_serveBatch() {
+  Batch batch(this);
+  _numberReceived = 0;
+  if (batch._size == 0) return;
+  _lastServed = micros();
+  _slave->_onBatchCb(_slave->_batchArg, batch);
+  for (size_t i = 0; i < batch._size; ++i) {
+    if (batch._answered[i]) _release(batch._index[i]);
+  }
+}
+
+// answered in a batch
+void Connection::_release(size_t index) {
+  _slave->_recordLatency(_queue[index].priority, _queue[index].since);
+  delete _queue[index].request;
+  _queue[index].request = nullptr;
+}
+
+Batch::Batch(Connection* connection) :
+  _connection(connection),
+  _size(0),
+  _index(),
+  _answered() {
+    // insertion sort on priority, then arrival
+    for (size_t n = 0; n < _connection->_numberReceived; ++n) {
+      size_t i = _connection->_received[n];
+      const Connection::Pending& p = _connection->_queue[i];
+      size_t j = _size++;
+      for (; j > 0; --j) {
+        const Connection::Pending& q = _connection->_queue[_index[j - 1]];
+        if (q.priority < p.priority || (q.priority == p.priority && q.since <= p.since)) break;
+        _index[j] = _index[j - 1];
+      }
+      _index[j] = i;
+    }
+}
+
+size_t Batch::size() const {
+  return _size;
+}
+
+const Message& Batch::request(size_t index) const {
+  return *_connection->_queue[_index[index]].request;
+}
+
+// responses are coalesced with the rest of this receive
+bool Batch::respond(size_t index, Error error, uint8_t* data, size_t len) {
+  if (index >= _size || _answered[index]) return false;
+  const Connection::Pending& p = _connection->_queue[_index[index]];
+  _connection->_peer = p.peer;
+  _answered[index] = true;
+  return _connection->_respond(*p.request, error, data, len);
+}
+
+bool Batch::answered(size_t index) const {
+  return index < _size && _answered[index];
+}
+
+void Connection::_flush() const {
+  if (_pendingBytes == 0) return;
+  log_v("flushing %d bytes", _pendingBytes);
+  _client->send();
+  ++(_slave->_packetCount);
+  _pendingBytes = 0;
+}
+
+// queued responses don't wait longer than MAX_COALESCE_DELAY
+void Connection::_flushOverdue() const {
+  if (_pendingBytes > 0 && millis() - _pendingSince >= MAX_COALESCE_DELAY) _flush();
+}
+
+void Connection::_record(capture::RecordType type, const uint8_t* data, size_t len) const {
+  if (_slave->_capture) _slave->_capture->record(type, _id, data, len);
+}
+
+void Connection::_recordRequest() const {
+  uint8_t parsed[4] = {low(_currentRequest->transactionId()),
+                       high(_currentRequest->transactionId()),
+                       _currentRequest->slaveId(),
+                       _currentRequest->functionalCode()};
+  _record(capture::MESSAGE, parsed, sizeof(parsed));
+}
+
+const Connection::Peer& Connection::_peerOf(const RequestMessage& request) const {
+#if defined(__cpp_impl_coroutine)
+  for (size_t i = 0; i < MAX_MODBUS_REQUESTS; ++i) {
+    if (_coroutines[i] && _coroutines[i]->_request == &request) return _coroutinePeers[i];
+  }
+#endif
+  return _peer;
 }
 
 void Connection::_onPoll(void* conn, AsyncClient* client) {
   Connection* c = static_cast<Connection*>(conn);
   // polling is about every 500ms
+  xSemaphoreTakeRecursive(c->_slave->_lock, portMAX_DELAY);
   ++(c->_keepaliveCount);
+  c->_slave->_service();
+  c->_slave->_deliverChanges();
+  xSemaphoreGiveRecursive(c->_slave->_lock);
   if (c->_keepaliveCount > CLIENT_KEEPALIVE) {
     log_v("client %d inactive, closing", client);
     c->_client->close(false);
   }
 }
 
+#if defined(__cpp_impl_coroutine)
+void Connection::_startCoroutine(Task task) {
+  if (!task._handle) {
+    respond(SERVER_DEVICE_BUSY);
+    return;
+  }
+  for (size_t i = 0; i < MAX_MODBUS_REQUESTS; ++i) {
+    if (!_coroutines[i]) {
+      std::coroutine_handle<Task::promise_type> handle = task._handle;
+      task._handle = nullptr;  // frame destroys itself when done
+      Task::promise_type& promise = handle.promise();
+      promise._connection = this;
+      promise._request = _currentRequest;  // keep request alive while suspended
+      promise._resumeQueue = _slave->_resumeQueue;
+      promise._since = _currentSince;
+      promise._priority = _currentPriority;
+      _currentRequest = nullptr;
+      _coroutines[i] = &promise;
+      _coroutinePeers[i] = _peer;
+      handle.resume();
+      return;
+    }
+  }
+  log_w("too many suspended requests");
+  respond(SERVER_DEVICE_BUSY);
+}
+
+void Connection::_coroutineReply(const Task::promise_type& promise, const Reply& reply) {
+  _respond(*promise._request, reply.error, reply.data, reply.len);
+  _slave->_recordLatency(promise._priority, promise._since);
+}
+
+void Connection::_coroutineDone(Task::promise_type* promise) {
+  for (size_t i = 0; i < MAX_MODBUS_REQUESTS; ++i) {
+    if (_coroutines[i] == promise) _coroutines[i] = nullptr;
+  }
+}
+#endif
+
+void Connection::_onAck(void* conn, AsyncClient* client, size_t len, uint32_t time) {
+  // responses went out: continue with requests left by the previous pass
+  Connection* c = static_cast<Connection*>(conn);
+  xSemaphoreTakeRecursive(c->_slave->_lock, portMAX_DELAY);
+  c->_slave->_service();
+  xSemaphoreGiveRecursive(c->_slave->_lock);
+}
+
 void Connection::_onDisconnect(void* conn, AsyncClient* client) {
   log_v("client disconnected");
   Connection* c = static_cast<Connection*>(conn);
-  c->_slave->_onClientDisconnect(c->_slave, c);
+  ModbusTCPSlave* slave = c->_slave;
+  xSemaphoreTakeRecursive(slave->_lock, portMAX_DELAY);
+  c->_record(capture::DISCONNECT);
+  slave->_onClientDisconnect(slave, c);
+  xSemaphoreGiveRecursive(slave->_lock);
 }
 
 }  // end namespace espModbus
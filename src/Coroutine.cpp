@@ -0,0 +1,113 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include "ModbusTCPSlave.h"
+
+#if defined(__cpp_impl_coroutine)
+
+namespace espModbus {
+
+static CoroutinePool coroutinePool;
+
+Reply::Reply(Error error, uint8_t* data, size_t len) :
+  error(error),
+  data(data),
+  len(len) {}
+
+Task::promise_type::promise_type() :
+  _connection(nullptr),
+  _request(nullptr),
+  _resumeQueue(nullptr),
+  _since(0),
+  _priority(0) {}
+
+Task::promise_type::~promise_type() {
+  if (_connection) _connection->_coroutineDone(this);
+  delete _request;
+}
+
+Task Task::promise_type::get_return_object() {
+  return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+}
+
+Task Task::promise_type::get_return_object_on_allocation_failure() {
+  return Task(nullptr);
+}
+
+std::suspend_always Task::promise_type::initial_suspend() noexcept {
+  // wait until the connection handed over the request
+  return {};
+}
+
+std::suspend_never Task::promise_type::final_suspend() noexcept {
+  return {};
+}
+
+void Task::promise_type::return_value(const Reply& reply) {
+  // locals of the handler are still alive here
+  if (_connection) {
+    _connection->_coroutineReply(*this, reply);
+  } else {
+    log_w("connection closed, reply dropped");
+  }
+}
+
+void Task::promise_type::unhandled_exception() {
+  log_e("unhandled exception in request handler, aborting");
+  abort();
+}
+
+QueueHandle_t Task::promise_type::resumeQueue() const {
+  return _resumeQueue;
+}
+
+void* Task::promise_type::operator new(size_t size) noexcept {
+  void* p = coroutinePool.allocate(size);
+  if (!p) {
+    log_e("no coroutine frame for %d bytes", size);
+  }
+  return p;
+}
+
+void Task::promise_type::operator delete(void* p) {
+  coroutinePool.release(p);
+}
+
+Task::Task(std::coroutine_handle<promise_type> handle) :
+  _handle(handle) {}
+
+Task::Task(Task&& other) :
+  _handle(other._handle) {
+    other._handle = nullptr;
+}
+
+Task::~Task() {
+  // never started: nobody else will clean up
+  if (_handle) _handle.destroy();
+}
+
+}  // end namespace espModbus
+
+#endif
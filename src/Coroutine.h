@@ -0,0 +1,190 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#pragma once
+
+#include "Config.h"
+
+#if defined(__cpp_impl_coroutine)
+
+#include <stdint.h>  // for uint*_t
+#include <stddef.h>  // for size_t
+#include <atomic>
+#include <coroutine>
+#include <functional>  // std::function
+
+#include <FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include "TypeDefs.h"
+#include "Message.h"
+#include "StaticPool.h"
+
+#ifndef COROUTINE_FRAME_SIZE
+#define COROUTINE_FRAME_SIZE 512
+#endif
+
+class ModbusTCPSlave;
+
+namespace espModbus {
+
+class Connection;
+
+// value of co_return in a coroutine handler, data only has to be valid
+// until co_return: the response is sent before the frame is destroyed
+struct Reply {
+  Reply(Error error = SUCCES, uint8_t* data = nullptr, size_t len = 0);
+  Error error;
+  uint8_t* data;
+  size_t len;
+};
+
+// Return type of coroutine request handlers:
+//
+//   espModbus::Task onRequest(void* arg, const espModbus::Message& request) {
+//     uint16_t value = co_await sensor;  // espModbus::Completion<uint16_t>
+//     uint8_t data[2] = {espModbus::high(value), espModbus::low(value)};
+//     co_return espModbus::Reply(espModbus::SUCCES, data, 2);
+//   }
+//
+// The library keeps the request alive while the handler is suspended
+// and resumes it on its own task as soon as the completion comes in.
+// Frames come from a fixed pool of MAX_MODBUS_COROUTINES slots of
+// COROUTINE_FRAME_SIZE bytes; when the pool is exhausted the request is
+// answered with SERVER_DEVICE_BUSY.
+class Task {
+  friend class Connection;
+
+ public:
+  class promise_type {
+    friend class Connection;
+
+   public:
+    promise_type();
+    ~promise_type();
+    Task get_return_object();
+    static Task get_return_object_on_allocation_failure();
+    std::suspend_always initial_suspend() noexcept;
+    std::suspend_never final_suspend() noexcept;
+    void return_value(const Reply& reply);
+    void unhandled_exception();
+    QueueHandle_t resumeQueue() const;
+
+    static void* operator new(size_t size) noexcept;
+    static void operator delete(void* p);
+
+   private:
+    Connection* _connection;
+    const RequestMessage* _request;
+    QueueHandle_t _resumeQueue;
+    uint32_t _since;  // us, latency is recorded at the reply
+    uint8_t _priority;
+  };
+
+  Task(Task&& other);
+  ~Task();
+
+ private:
+  explicit Task(std::coroutine_handle<promise_type> handle);
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+
+  std::coroutine_handle<promise_type> _handle;
+};
+
+#if MODBUS_STATIC_ALLOCATION
+typedef Task (*OnAsyncRequestCb)(void*, const Message&);
+#else
+typedef std::function<Task(void*, const Message&)> OnAsyncRequestCb;
+#endif
+
+typedef StaticPool<COROUTINE_FRAME_SIZE, MAX_MODBUS_COROUTINES> CoroutinePool;
+
+// Awaitable result of an operation finished by another task or an ISR:
+// the handler does `co_await completion`, the other side calls
+// `complete(value)`, or `completeFromISR(value)` in an interrupt
+// handler. If the value is already there the handler doesn't suspend at
+// all. Use reset() before reusing it.
+template <typename T>
+class Completion {
+ public:
+  Completion() :
+    _state(EMPTY),
+    _value(),
+    _waiter(nullptr),
+    _queue(nullptr) {}
+
+  void complete(const T& value) {
+    _value = value;
+    if (_state.exchange(DONE, std::memory_order_acq_rel) == WAITING) {
+      xQueueSend(_queue, &_waiter, 0);
+    }
+  }
+
+  void completeFromISR(const T& value) {
+    _value = value;
+    if (_state.exchange(DONE, std::memory_order_acq_rel) == WAITING) {
+      BaseType_t woken = pdFALSE;
+      xQueueSendFromISR(_queue, &_waiter, &woken);
+      if (woken) portYIELD_FROM_ISR();
+    }
+  }
+
+  void reset() {
+    _state.store(EMPTY, std::memory_order_release);
+  }
+
+  bool await_ready() const noexcept {
+    return _state.load(std::memory_order_acquire) == DONE;
+  }
+
+  bool await_suspend(std::coroutine_handle<Task::promise_type> handle) noexcept {
+    _waiter = handle.address();
+    _queue = handle.promise().resumeQueue();
+    State expected = EMPTY;
+    // false: completed in the meantime, continue right away
+    return _state.compare_exchange_strong(expected, WAITING, std::memory_order_acq_rel);
+  }
+
+  T await_resume() {
+    return _value;
+  }
+
+ private:
+  enum State : uint8_t {
+    EMPTY,
+    WAITING,
+    DONE
+  };
+  std::atomic<State> _state;
+  T _value;
+  void* _waiter;
+  QueueHandle_t _queue;
+};
+
+}  // end namespace espModbus
+
+#endif
@@ -37,15 +37,15 @@ inline uint8_t high(uint16_t in) {
   return ((in >> 8) & 0xff);
 }
 
-inline uint8_t coilsToBytes(uint8_t noCoils) {
+inline uint8_t coilsToBytes(uint16_t noCoils) {
   return (noCoils + 8 - 1) / 8;
 }
 
-inline uint8_t inputsToBytes(uint8_t noInputs) {
+inline uint8_t inputsToBytes(uint16_t noInputs) {
   return coilsToBytes(noInputs);
 }
 
-inline uint8_t registersToBytes(uint8_t noRegisters) {
+inline uint8_t registersToBytes(uint16_t noRegisters) {
   return noRegisters * 2;
 }
 
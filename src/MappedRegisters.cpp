@@ -0,0 +1,213 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include "MappedRegisters.h"
+
+#if defined(__linux__)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>  // std::min
+#include <chrono>
+#include <cstring>  // for memcpy
+
+#include "Helpers.h"
+
+namespace espModbus {
+
+namespace {
+
+struct Header {
+  char magic[4];
+  uint16_t address;
+  uint16_t noRegisters;
+  uint32_t reserved[2];
+};
+
+const char MAGIC[4] = {'e', 'M', 'B', 'R'};
+
+}  // end anonymous namespace
+
+MappedRegisters::MappedRegisters(const char* path, uint16_t address, uint16_t noRegisters, uint32_t flushInterval) :
+  _path(path),
+  _address(address),
+  _noRegisters(noRegisters),
+  _flushInterval(flushInterval),
+  _fd(-1),
+  _map(nullptr),
+  _mapLength(sizeof(Header) + noRegisters * 2),
+  _pageSize(sysconf(_SC_PAGESIZE)),
+  _dirty(nullptr),
+  _dirtyWords(0),
+  _thread(),
+  _mutex(),
+  _cv(),
+  _running(false) {
+    size_t pages = (_mapLength + _pageSize - 1) / _pageSize;
+    _dirtyWords = (pages + 31) / 32;
+    _dirty = new std::atomic<uint32_t>[_dirtyWords];
+    for (size_t i = 0; i < _dirtyWords; ++i) _dirty[i] = 0;
+}
+
+MappedRegisters::~MappedRegisters() {
+  end();
+  delete[] _dirty;
+}
+
+bool MappedRegisters::begin() {
+  if (_map) return true;
+  _fd = open(_path, O_RDWR | O_CREAT, 0644);
+  if (_fd < 0) return false;
+  struct stat st;
+  if (fstat(_fd, &st) != 0) {
+    end();
+    return false;
+  }
+  bool fresh = (static_cast<size_t>(st.st_size) < sizeof(Header));
+  if (static_cast<size_t>(st.st_size) != _mapLength && ftruncate(_fd, _mapLength) != 0) {
+    end();
+    return false;
+  }
+  void* map = mmap(nullptr, _mapLength, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+  if (map == MAP_FAILED) {
+    end();
+    return false;
+  }
+  _map = static_cast<uint8_t*>(map);
+  Header* header = reinterpret_cast<Header*>(_map);
+  if (!fresh && (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->address != _address)) {
+    // not ours or a different layout
+    end();
+    return false;
+  }
+  if (fresh || header->noRegisters != _noRegisters) {
+    // new registers (file grown) are zero, existing ones are kept
+    memcpy(header->magic, MAGIC, sizeof(MAGIC));
+    header->address = _address;
+    header->noRegisters = _noRegisters;
+    msync(_map, _mapLength, MS_SYNC);
+  }
+  _running = true;
+  _thread = std::thread(&MappedRegisters::_flusher, this);
+  return true;
+}
+
+void MappedRegisters::end() {
+  if (_thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _running = false;
+    }
+    _cv.notify_one();
+    _thread.join();
+  }
+  if (_map) {
+    flush();
+    munmap(_map, _mapLength);
+    _map = nullptr;
+  }
+  if (_fd >= 0) {
+    close(_fd);
+    _fd = -1;
+  }
+}
+
+void MappedRegisters::flush() {
+  if (!_map) return;
+  for (size_t word = 0; word < _dirtyWords; ++word) {
+    uint32_t bits = _dirty[word].exchange(0, std::memory_order_acq_rel);
+    while (bits) {
+      // sync runs of consecutive dirty pages in one call
+      size_t first = __builtin_ctz(bits);
+      size_t last = first;
+      while (last < 31 && (bits & (1UL << (last + 1)))) ++last;
+      for (size_t page = first; page <= last; ++page) bits &= ~(1UL << page);
+      size_t offset = (word * 32 + first) * _pageSize;
+      size_t length = std::min((last - first + 1) * _pageSize, _mapLength - offset);
+      msync(_map + offset, length, MS_SYNC);
+    }
+  }
+}
+
+uint16_t MappedRegisters::get(uint16_t address) const {
+  if (!_map || !_inRange(address, 1)) return 0;
+  const uint8_t* reg = _register(address);
+  return (reg[0] << 8 | reg[1]);
+}
+
+void MappedRegisters::set(uint16_t address, uint16_t value) {
+  if (!_map || !_inRange(address, 1)) return;
+  uint8_t* reg = _register(address);
+  reg[0] = high(value);
+  reg[1] = low(value);
+  _markDirty(reg - _map, 2);
+}
+
+Error MappedRegisters::read(uint8_t /* slaveId */, uint16_t address, uint16_t noRegisters, uint8_t* data) {
+  if (!_map) return SERVER_DEVICE_FAILURE;
+  if (!_inRange(address, noRegisters)) return ILLEGAL_DATA_ADDRESS;
+  memcpy(data, _register(address), noRegisters * 2);
+  return SUCCES;
+}
+
+Error MappedRegisters::write(uint8_t /* slaveId */, uint16_t address, uint16_t noRegisters, const uint8_t* data) {
+  if (!_map) return SERVER_DEVICE_FAILURE;
+  if (!_inRange(address, noRegisters)) return ILLEGAL_DATA_ADDRESS;
+  uint8_t* reg = _register(address);
+  memcpy(reg, data, noRegisters * 2);
+  _markDirty(reg - _map, noRegisters * 2);
+  return SUCCES;
+}
+
+bool MappedRegisters::_inRange(uint16_t address, uint16_t noRegisters) const {
+  return address >= _address &&
+         static_cast<uint32_t>(address) + noRegisters <= static_cast<uint32_t>(_address) + _noRegisters;
+}
+
+uint8_t* MappedRegisters::_register(uint16_t address) const {
+  return _map + sizeof(Header) + (address - _address) * 2;
+}
+
+void MappedRegisters::_markDirty(size_t offset, size_t length) {
+  for (size_t page = offset / _pageSize; page <= (offset + length - 1) / _pageSize; ++page) {
+    _dirty[page / 32].fetch_or(1UL << (page % 32), std::memory_order_release);
+  }
+}
+
+void MappedRegisters::_flusher() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (_running) {
+    _cv.wait_for(lock, std::chrono::milliseconds(_flushInterval));
+    lock.unlock();
+    flush();
+    lock.lock();
+  }
+}
+
+}  // end namespace espModbus
+
+#endif
@@ -0,0 +1,99 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#pragma once
+
+#if defined(__linux__)
+
+#include <stdint.h>  // for uint*_t
+#include <stddef.h>  // for size_t
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "RegisterBank.h"
+
+#ifndef MAPPED_FLUSH_INTERVAL
+#define MAPPED_FLUSH_INTERVAL 1000  // ms between syncs of dirty pages
+#endif
+
+namespace espModbus {
+
+// Holding registers stored in a memory mapped file, for gateways running
+// on Linux. Registers survive a restart and are available right after
+// begin(), no loading needed.
+//
+// The file holds a small header followed by the registers as big endian
+// bytes, so reads are copied straight from the mapping into the response.
+// Writes go to the mapping and mark their pages dirty; a background
+// thread syncs dirty pages to disk every flush interval, the request path
+// never waits on the disk. A process crash loses nothing (the page cache
+// holds the data), a power loss at most one flush interval.
+//
+// ModbusTCPSlave needs AsyncTCP, which only exists on the ESP32, so on
+// Linux the bank can't be attached to the slave of this library. A
+// gateway calls read() and write() from its own Modbus server; the host
+// tests in extras/tests do the same.
+class MappedRegisters : public RegisterBank {
+ public:
+  MappedRegisters(const char* path, uint16_t address, uint16_t noRegisters, uint32_t flushInterval = MAPPED_FLUSH_INTERVAL);
+  ~MappedRegisters();
+  bool begin();
+  void end();
+  void flush();
+  uint16_t get(uint16_t address) const;
+  void set(uint16_t address, uint16_t value);
+
+  virtual Error read(uint8_t slaveId, uint16_t address, uint16_t noRegisters, uint8_t* data);
+  virtual Error write(uint8_t slaveId, uint16_t address, uint16_t noRegisters, const uint8_t* data);
+
+ private:
+  MappedRegisters(const MappedRegisters&) = delete;
+  MappedRegisters& operator=(const MappedRegisters&) = delete;
+  bool _inRange(uint16_t address, uint16_t noRegisters) const;
+  uint8_t* _register(uint16_t address) const;
+  void _markDirty(size_t offset, size_t length);
+  void _flusher();
+
+  const char* _path;
+  uint16_t _address;
+  uint16_t _noRegisters;
+  uint32_t _flushInterval;
+  int _fd;
+  uint8_t* _map;
+  size_t _mapLength;
+  size_t _pageSize;
+  std::atomic<uint32_t>* _dirty;  // one bit per page
+  size_t _dirtyWords;
+  std::thread _thread;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  bool _running;
+};
+
+}  // end namespace espModbus
+
+#endif
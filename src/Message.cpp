@@ -27,6 +27,32 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 namespace espModbus {
 
+#if MODBUS_STATIC_ALLOCATION
+static MessagePool messagePool;
+
+void* Message::operator new(size_t size) noexcept {
+  return messagePool.allocate(size);
+}
+
+void Message::operator delete(void* p) {
+  messagePool.release(p);
+}
+
+Message::Message(const Message& m) :
+  _buffer(_storage),
+  _length(m._length) {
+    memcpy(_buffer, m._buffer, _length);
+}
+
+Message::Message(Message&& m) :
+  _buffer(_storage),
+  _length(m._length) {
+    memcpy(_buffer, m._buffer, _length);
+    m._length = 0;
+}
+
+Message::~Message() {}
+#else
 Message::Message(const Message& m) :
   _buffer(new uint8_t[m._length]),
   _length(m._length) {
@@ -44,6 +70,7 @@ Message::~Message() {
   if (_buffer)
     delete[] _buffer;
 }
+#endif
 
 uint8_t* Message::data() const {
   return _buffer;
@@ -72,12 +99,62 @@ uint16_t Message::noRegisters() const {
   return (_buffer[10] << 8 | _buffer[11]);
 }
 
+uint16_t Message::value() const {
+  return (_buffer[10] << 8 | _buffer[11]);
+}
+
+uint16_t Message::writeAddress() const {
+  return (_buffer[12] << 8 | _buffer[13]);
+}
+
+uint16_t Message::noWriteRegisters() const {
+  return (_buffer[14] << 8 | _buffer[15]);
+}
+
+uint8_t Message::byteCount() const {
+  if (functionalCode() == READ_WRITE_MULT_REGISTERS) return _buffer[16];
+  return _buffer[12];
+}
+
+const uint8_t* Message::payload() const {
+  switch (functionalCode()) {
+    case WRITE_COIL:
+    case WRITE_HOLD_REGISTER:
+      return &_buffer[10];
+    case WRITE_MULT_COILS:
+    case WRITE_MULT_REGISTERS:
+      return &_buffer[13];
+    case READ_WRITE_MULT_REGISTERS:
+      return &_buffer[17];
+    default:
+      return nullptr;
+  }
+}
+
+size_t Message::payloadLength() const {
+  switch (functionalCode()) {
+    case WRITE_COIL:
+    case WRITE_HOLD_REGISTER:
+      return 2;
+    case WRITE_MULT_COILS:
+    case WRITE_MULT_REGISTERS:
+    case READ_WRITE_MULT_REGISTERS:
+      return byteCount();
+    default:
+      return 0;
+  }
+}
+
 Message::Message(uint16_t transactionId,
                  size_t length,
                  uint8_t slaveId) :
   _buffer(nullptr),
   _length(length + 7) {  // 7: length of MBAP header
+#if MODBUS_STATIC_ALLOCATION
+    _buffer = _storage;
+#else
     _buffer = new uint8_t[_length];
+#endif
     memset(_buffer, 0, _length);
     _buffer[0] = high(transactionId);
     _buffer[1] = low(transactionId);
@@ -89,11 +166,30 @@ Message::Message(uint16_t transactionId,
     _buffer[6] = slaveId;
   }
 
+Message::Message(const uint8_t* frame, size_t length) :
+#if MODBUS_STATIC_ALLOCATION
+  _buffer(_storage),
+#else
+  _buffer(new uint8_t[length]),
+#endif
+  _length(length) {
+    memcpy(_buffer, frame, _length);
+}
+
 RequestMessage::RequestMessage(uint16_t transactionId,
                                size_t length,
                                uint8_t slaveId) :
   Message(transactionId, length, slaveId) {}
 
+RequestMessage::RequestMessage(const uint8_t* frame, size_t length) :
+  Message(frame, length) {}
+
+Error RequestMessage::_checkRange(uint16_t address, uint16_t quantity, uint16_t maxQuantity) {
+  if (quantity == 0 || quantity > maxQuantity) return ILLEGAL_DATA_VALUE;
+  if (static_cast<uint32_t>(address) + quantity > 0x10000) return ILLEGAL_DATA_ADDRESS;
+  return SUCCES;
+}
+
 Request01::Request01(uint16_t transaction,
                      uint8_t slaveId,
                      uint16_t address,
@@ -106,6 +202,13 @@ Request01::Request01(uint16_t transaction,
     _buffer[11] = low(noCoils);
 }
 
+Request01::Request01(const uint8_t* frame, size_t length) :
+  RequestMessage(frame, length) {}
+
+Error Request01::validate() const {
+  return _checkRange(address(), noRegisters(), 2000);
+}
+
 ResponseMessage* Request01::createResponse(Error error, uint8_t* data, size_t len) const {
   ResponseMessage* response = nullptr;
   if (error == SUCCES) {
@@ -135,6 +238,13 @@ Request02::Request02(uint16_t transaction,
     _buffer[11] = low(noInputs);
 }
 
+Request02::Request02(const uint8_t* frame, size_t length) :
+  RequestMessage(frame, length) {}
+
+Error Request02::validate() const {
+  return _checkRange(address(), noRegisters(), 2000);
+}
+
 ResponseMessage* Request02::createResponse(Error error, uint8_t* data, size_t len) const {
   ResponseMessage* response = nullptr;
   if (error == SUCCES) {
@@ -164,6 +274,13 @@ Request03::Request03(uint16_t transaction,
     _buffer[11] = low(noRegisters);
 }
 
+Request03::Request03(const uint8_t* frame, size_t length) :
+  RequestMessage(frame, length) {}
+
+Error Request03::validate() const {
+  return _checkRange(address(), noRegisters(), 125);
+}
+
 ResponseMessage* Request03::createResponse(Error error, uint8_t* data, size_t len) const {
   ResponseMessage* response = nullptr;
   if (error == SUCCES) {
@@ -181,14 +298,302 @@ ResponseMessage* Request03::createResponse(Error error, uint8_t* data, size_t le
   return response;
 }
 
+Request04::Request04(uint16_t transaction,
+                     uint8_t slaveId,
+                     uint16_t address,
+                     uint16_t noRegisters) :
+  RequestMessage(transaction, 5, slaveId) {
+    _buffer[7] = READ_INPUT_REGISTERS;
+    _buffer[8] = high(address);
+    _buffer[9] = low(address);
+    _buffer[10] = high(noRegisters);
+    _buffer[11] = low(noRegisters);
+}
+
+Request04::Request04(const uint8_t* frame, size_t length) :
+  RequestMessage(frame, length) {}
+
+Error Request04::validate() const {
+  return _checkRange(address(), noRegisters(), 125);
+}
+
+ResponseMessage* Request04::createResponse(Error error, uint8_t* data, size_t len) const {
+  ResponseMessage* response = nullptr;
+  if (error == SUCCES) {
+    response = new Response04(transactionId(),
+                              slaveId(),
+                              noRegisters(),
+                              data,
+                              len);
+  } else {
+    response = new ResponseError(transactionId(),
+                                 slaveId(),
+                                 functionalCode(),
+                                 error);
+  }
+  return response;
+}
+
+Request05::Request05(uint16_t transaction,
+                     uint8_t slaveId,
+                     uint16_t address,
+                     bool value) :
+  RequestMessage(transaction, 5, slaveId) {
+    _buffer[7] = WRITE_COIL;
+    _buffer[8] = high(address);
+    _buffer[9] = low(address);
+    _buffer[10] = value ? 0xFF : 0x00;
+    _buffer[11] = 0x00;
+}
+
+Request05::Request05(const uint8_t* frame, size_t length) :
+  RequestMessage(frame, length) {}
+
+Error Request05::validate() const {
+  if (value() != 0x0000 && value() != 0xFF00) return ILLEGAL_DATA_VALUE;
+  return SUCCES;
+}
+
+ResponseMessage* Request05::createResponse(Error error, uint8_t*, size_t) const {
+  ResponseMessage* response = nullptr;
+  if (error == SUCCES) {
+    response = new Response05(transactionId(),
+                              slaveId(),
+                              address(),
+                              value());
+  } else {
+    response = new ResponseError(transactionId(),
+                                 slaveId(),
+                                 functionalCode(),
+                                 error);
+  }
+  return response;
+}
+
+Request06::Request06(uint16_t transaction,
+                     uint8_t slaveId,
+                     uint16_t address,
+                     uint16_t value) :
+  RequestMessage(transaction, 5, slaveId) {
+    _buffer[7] = WRITE_HOLD_REGISTER;
+    _buffer[8] = high(address);
+    _buffer[9] = low(address);
+    _buffer[10] = high(value);
+    _buffer[11] = low(value);
+}
+
+Request06::Request06(const uint8_t* frame, size_t length) :
+  RequestMessage(frame, length) {}
+
+Error Request06::validate() const {
+  return SUCCES;
+}
+
+ResponseMessage* Request06::createResponse(Error error, uint8_t*, size_t) const {
+  ResponseMessage* response = nullptr;
+  if (error == SUCCES) {
+    response = new Response06(transactionId(),
+                              slaveId(),
+                              address(),
+                              value());
+  } else {
+    response = new ResponseError(transactionId(),
+                                 slaveId(),
+                                 functionalCode(),
+                                 error);
+  }
+  return response;
+}
+
+Request0F::Request0F(uint16_t transaction,
+                     uint8_t slaveId,
+                     uint16_t address,
+                     uint16_t noCoils,
+                     const uint8_t* data) :
+  RequestMessage(transaction, coilsToBytes(noCoils) + 6, slaveId) {
+    _buffer[7] = WRITE_MULT_COILS;
+    _buffer[8] = high(address);
+    _buffer[9] = low(address);
+    _buffer[10] = high(noCoils);
+    _buffer[11] = low(noCoils);
+    _buffer[12] = coilsToBytes(noCoils);
+    memcpy(&_buffer[13], data, _buffer[12]);
+}
+
+Request0F::Request0F(const uint8_t* frame, size_t length) :
+  RequestMessage(frame, length) {}
+
+Error Request0F::validate() const {
+  Error error = _checkRange(address(), noRegisters(), 1968);
+  if (error == SUCCES && byteCount() != coilsToBytes(noRegisters())) return ILLEGAL_DATA_VALUE;
+  return error;
+}
+
+ResponseMessage* Request0F::createResponse(Error error, uint8_t*, size_t) const {
+  ResponseMessage* response = nullptr;
+  if (error == SUCCES) {
+    response = new Response0F(transactionId(),
+                              slaveId(),
+                              address(),
+                              noRegisters());
+  } else {
+    response = new ResponseError(transactionId(),
+                                 slaveId(),
+                                 functionalCode(),
+                                 error);
+  }
+  return response;
+}
+
+Request10::Request10(uint16_t transaction,
+                     uint8_t slaveId,
+                     uint16_t address,
+                     uint16_t noRegisters,
+                     const uint8_t* data) :
+  RequestMessage(transaction, registersToBytes(noRegisters) + 6, slaveId) {
+    _buffer[7] = WRITE_MULT_REGISTERS;
+    _buffer[8] = high(address);
+    _buffer[9] = low(address);
+    _buffer[10] = high(noRegisters);
+    _buffer[11] = low(noRegisters);
+    _buffer[12] = registersToBytes(noRegisters);
+    memcpy(&_buffer[13], data, _buffer[12]);
+}
+
+Request10::Request10(const uint8_t* frame, size_t length) :
+  RequestMessage(frame, length) {}
+
+Error Request10::validate() const {
+  Error error = _checkRange(address(), noRegisters(), 123);
+  if (error == SUCCES && byteCount() != registersToBytes(noRegisters())) return ILLEGAL_DATA_VALUE;
+  return error;
+}
+
+ResponseMessage* Request10::createResponse(Error error, uint8_t*, size_t) const {
+  ResponseMessage* response = nullptr;
+  if (error == SUCCES) {
+    response = new Response10(transactionId(),
+                              slaveId(),
+                              address(),
+                              noRegisters());
+  } else {
+    response = new ResponseError(transactionId(),
+                                 slaveId(),
+                                 functionalCode(),
+                                 error);
+  }
+  return response;
+}
+
+Request17::Request17(uint16_t transaction,
+                     uint8_t slaveId,
+                     uint16_t readAddress,
+                     uint16_t noReadRegisters,
+                     uint16_t writeAddress,
+                     uint16_t noWriteRegisters,
+                     const uint8_t* data) :
+  RequestMessage(transaction, registersToBytes(noWriteRegisters) + 10, slaveId) {
+    _buffer[7] = READ_WRITE_MULT_REGISTERS;
+    _buffer[8] = high(readAddress);
+    _buffer[9] = low(readAddress);
+    _buffer[10] = high(noReadRegisters);
+    _buffer[11] = low(noReadRegisters);
+    _buffer[12] = high(writeAddress);
+    _buffer[13] = low(writeAddress);
+    _buffer[14] = high(noWriteRegisters);
+    _buffer[15] = low(noWriteRegisters);
+    _buffer[16] = registersToBytes(noWriteRegisters);
+    memcpy(&_buffer[17], data, _buffer[16]);
+}
+
+Request17::Request17(const uint8_t* frame, size_t length) :
+  RequestMessage(frame, length) {}
+
+Error Request17::validate() const {
+  Error error = _checkRange(address(), noRegisters(), 125);
+  if (error == SUCCES) error = _checkRange(writeAddress(), noWriteRegisters(), 121);
+  if (error == SUCCES && byteCount() != registersToBytes(noWriteRegisters())) return ILLEGAL_DATA_VALUE;
+  return error;
+}
+
+ResponseMessage* Request17::createResponse(Error error, uint8_t* data, size_t len) const {
+  ResponseMessage* response = nullptr;
+  if (error == SUCCES) {
+    response = new Response17(transactionId(),
+                              slaveId(),
+                              noRegisters(),
+                              data,
+                              len);
+  } else {
+    response = new ResponseError(transactionId(),
+                                 slaveId(),
+                                 functionalCode(),
+                                 error);
+  }
+  return response;
+}
+
+RequestFrame::RequestFrame(const uint8_t* frame, size_t length) :
+  RequestMessage(frame, length) {}
+
+Error RequestFrame::validate() const {
+  return SUCCES;
+}
+
+ResponseMessage* RequestFrame::createResponse(Error error, uint8_t* data, size_t len) const {
+  if (error == SUCCES && len <= MAX_ADU_LENGTH - 8) {
+    uint8_t frame[MAX_ADU_LENGTH];
+    memcpy(frame, _buffer, 8);
+    frame[4] = 0;
+    frame[5] = len + 2;
+    if (len > 0) memcpy(&frame[8], data, len);
+    return new ResponseFrame(frame, len + 8);
+  }
+  return new ResponseError(transactionId(),
+                           slaveId(),
+                           functionalCode(),
+                           (error == SUCCES) ? SERVER_DEVICE_FAILURE : error);
+}
+
 ResponseMessage::ResponseMessage(uint16_t transactionId,
                                  size_t length,
                                  uint8_t slaveId) :
   Message(transactionId, length, slaveId) {}
 
+ResponseMessage::ResponseMessage(const uint8_t* frame, size_t length) :
+  Message(frame, length) {}
+
+// exception code of an error response
+Error ResponseMessage::error() const {
+  if (_buffer[7] & 0x80) return static_cast<Error>(_buffer[8]);
+  return SUCCES;
+}
+
+// coil, input or register values of a read response
+const uint8_t* ResponseMessage::values() const {
+  if (valuesLength() == 0) return nullptr;
+  return &_buffer[9];
+}
+
+size_t ResponseMessage::valuesLength() const {
+  switch (_buffer[7]) {
+    case READ_COILS:
+    case READ_DISCR_INPUTS:
+    case READ_HOLD_REGISTERS:
+    case READ_INPUT_REGISTERS:
+    case READ_WRITE_MULT_REGISTERS:
+      return _buffer[8];
+    default:
+      return 0;
+  }
+}
+
+ResponseFrame::ResponseFrame(const uint8_t* frame, size_t length) :
+  ResponseMessage(frame, length) {}
+
 Response01::Response01(uint16_t transaction,
                        uint8_t slaveId,
-                       uint8_t noCoils,
+                       uint16_t noCoils,
                        uint8_t* data,
                        uint8_t len) :
   ResponseMessage(transaction, ((noCoils + 8 - 1) / 8) + 2, slaveId) {
@@ -202,7 +607,7 @@ Response01::Response01(uint16_t transaction,
 
 Response02::Response02(uint16_t transaction,
                        uint8_t slaveId,
-                       uint8_t noInputs,
+                       uint16_t noInputs,
                        uint8_t* data,
                        uint8_t len) :
   ResponseMessage(transaction, ((noInputs + 8 - 1) / 8) + 2, slaveId) {
@@ -228,13 +633,89 @@ Response03::Response03(uint16_t transaction,
     }
   }
 
+Response04::Response04(uint16_t transaction,
+                       uint8_t slaveId,
+                       uint8_t noRegisters,
+                       uint8_t* data,
+                       uint8_t len) :
+  ResponseMessage(transaction, (noRegisters * 2) + 2, slaveId) {
+    _buffer[7] = READ_INPUT_REGISTERS;
+    size_t noBytes = noRegisters * 2;
+    _buffer[8] = noBytes;
+    for (size_t i = 0; i < len; ++i) {
+      _buffer[9 + i] = data[i];
+    }
+  }
+
+Response05::Response05(uint16_t transaction,
+                       uint8_t slaveId,
+                       uint16_t address,
+                       uint16_t value) :
+  ResponseMessage(transaction, 5, slaveId) {
+    _buffer[7] = WRITE_COIL;
+    _buffer[8] = high(address);
+    _buffer[9] = low(address);
+    _buffer[10] = high(value);
+    _buffer[11] = low(value);
+  }
+
+Response06::Response06(uint16_t transaction,
+                       uint8_t slaveId,
+                       uint16_t address,
+                       uint16_t value) :
+  ResponseMessage(transaction, 5, slaveId) {
+    _buffer[7] = WRITE_HOLD_REGISTER;
+    _buffer[8] = high(address);
+    _buffer[9] = low(address);
+    _buffer[10] = high(value);
+    _buffer[11] = low(value);
+  }
+
+Response0F::Response0F(uint16_t transaction,
+                       uint8_t slaveId,
+                       uint16_t address,
+                       uint16_t noCoils) :
+  ResponseMessage(transaction, 5, slaveId) {
+    _buffer[7] = WRITE_MULT_COILS;
+    _buffer[8] = high(address);
+    _buffer[9] = low(address);
+    _buffer[10] = high(noCoils);
+    _buffer[11] = low(noCoils);
+  }
+
+Response10::Response10(uint16_t transaction,
+                       uint8_t slaveId,
+                       uint16_t address,
+                       uint16_t noRegisters) :
+  ResponseMessage(transaction, 5, slaveId) {
+    _buffer[7] = WRITE_MULT_REGISTERS;
+    _buffer[8] = high(address);
+    _buffer[9] = low(address);
+    _buffer[10] = high(noRegisters);
+    _buffer[11] = low(noRegisters);
+  }
+
+Response17::Response17(uint16_t transaction,
+                       uint8_t slaveId,
+                       uint8_t noRegisters,
+                       uint8_t* data,
+                       uint8_t len) :
+  ResponseMessage(transaction, (noRegisters * 2) + 2, slaveId) {
+    _buffer[7] = READ_WRITE_MULT_REGISTERS;
+    size_t noBytes = noRegisters * 2;
+    _buffer[8] = noBytes;
+    for (size_t i = 0; i < len; ++i) {
+      _buffer[9 + i] = data[i];
+    }
+  }
+
 ResponseError::ResponseError(uint16_t transaction,
                              uint8_t slaveId,
                              FunctionalCode fc,
                              Error error) :
   ResponseMessage(transaction, 2, slaveId) {
-    _buffer[6] |= 0x80;
-    _buffer[7] = error;
+    _buffer[7] = fc | 0x80;
+    _buffer[8] = error;
   }
 
 }  // end namespace espModbus
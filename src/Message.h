@@ -31,8 +31,10 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include <esp32-hal-log.h>
 
+#include "Config.h"
 #include "TypeDefs.h"
 #include "Helpers.h"
+#include "StaticPool.h"
 
 namespace espModbus {
 
@@ -53,23 +55,46 @@ class Message {
   FunctionalCode functionalCode() const;
   uint16_t address() const;
   uint16_t noRegisters() const;
+  uint16_t value() const;
+  uint16_t writeAddress() const;
+  uint16_t noWriteRegisters() const;
+  uint8_t byteCount() const;
+  const uint8_t* payload() const;
+  size_t payloadLength() const;
+
+#if MODBUS_STATIC_ALLOCATION
+  static void* operator new(size_t size) noexcept;
+  static void operator delete(void* p);
+#endif
 
  protected:
   Message(uint16_t transactionId,
           size_t length,
           uint8_t slaveId);
+  Message(const uint8_t* frame, size_t length);
   uint8_t* _buffer;
   size_t _length;
+#if MODBUS_STATIC_ALLOCATION
+  uint8_t _storage[MAX_ADU_LENGTH];
+#endif
 };
 
+#if MODBUS_STATIC_ALLOCATION
+// all message classes share the layout of Message
+typedef StaticPool<sizeof(Message), MAX_MODBUS_MESSAGES> MessagePool;
+#endif
+
 class RequestMessage : public Message {
  public:
   virtual ResponseMessage* createResponse(Error error, uint8_t* data = nullptr, size_t len = 0) const = 0;
+  virtual Error validate() const = 0;
 
  protected:
   RequestMessage(uint16_t transactionId,
                  size_t length,
                 uint8_t slaveId);
+  RequestMessage(const uint8_t* frame, size_t length);
+  static Error _checkRange(uint16_t address, uint16_t quantity, uint16_t maxQuantity);
 };
 
 class Request01 : public RequestMessage {
@@ -78,7 +103,9 @@ class Request01 : public RequestMessage {
             uint8_t slaveId,
             uint16_t address,
             uint16_t noCoils);
+  Request01(const uint8_t* frame, size_t length);
   virtual ResponseMessage* createResponse(Error error, uint8_t* data = nullptr, size_t len = 0) const;
+  virtual Error validate() const;
 };
 
 class Request02 : public RequestMessage {
@@ -87,7 +114,9 @@ class Request02 : public RequestMessage {
             uint8_t slaveId,
             uint16_t address,
             uint16_t noInputs);
+  Request02(const uint8_t* frame, size_t length);
   virtual ResponseMessage* createResponse(Error error, uint8_t* data = nullptr, size_t len = 0) const;
+  virtual Error validate() const;
 };
 
 class Request03 : public RequestMessage {
@@ -96,21 +125,116 @@ class Request03 : public RequestMessage {
             uint8_t slaveId,
             uint16_t address,
             uint16_t noRegisters);
+  Request03(const uint8_t* frame, size_t length);
+  virtual ResponseMessage* createResponse(Error error, uint8_t* data = nullptr, size_t len = 0) const;
+  virtual Error validate() const;
+};
+
+class Request04 : public RequestMessage {
+ public:
+  Request04(uint16_t transaction,
+            uint8_t slaveId,
+            uint16_t address,
+            uint16_t noRegisters);
+  Request04(const uint8_t* frame, size_t length);
+  virtual ResponseMessage* createResponse(Error error, uint8_t* data = nullptr, size_t len = 0) const;
+  virtual Error validate() const;
+};
+
+class Request05 : public RequestMessage {
+ public:
+  Request05(uint16_t transaction,
+            uint8_t slaveId,
+            uint16_t address,
+            bool value);
+  Request05(const uint8_t* frame, size_t length);
   virtual ResponseMessage* createResponse(Error error, uint8_t* data = nullptr, size_t len = 0) const;
+  virtual Error validate() const;
+};
+
+class Request06 : public RequestMessage {
+ public:
+  Request06(uint16_t transaction,
+            uint8_t slaveId,
+            uint16_t address,
+            uint16_t value);
+  Request06(const uint8_t* frame, size_t length);
+  virtual ResponseMessage* createResponse(Error error, uint8_t* data = nullptr, size_t len = 0) const;
+  virtual Error validate() const;
+};
+
+class Request0F : public RequestMessage {
+ public:
+  Request0F(uint16_t transaction,
+            uint8_t slaveId,
+            uint16_t address,
+            uint16_t noCoils,
+            const uint8_t* data);
+  Request0F(const uint8_t* frame, size_t length);
+  virtual ResponseMessage* createResponse(Error error, uint8_t* data = nullptr, size_t len = 0) const;
+  virtual Error validate() const;
+};
+
+class Request10 : public RequestMessage {
+ public:
+  Request10(uint16_t transaction,
+            uint8_t slaveId,
+            uint16_t address,
+            uint16_t noRegisters,
+            const uint8_t* data);
+  Request10(const uint8_t* frame, size_t length);
+  virtual ResponseMessage* createResponse(Error error, uint8_t* data = nullptr, size_t len = 0) const;
+  virtual Error validate() const;
+};
+
+class Request17 : public RequestMessage {
+ public:
+  Request17(uint16_t transaction,
+            uint8_t slaveId,
+            uint16_t readAddress,
+            uint16_t noReadRegisters,
+            uint16_t writeAddress,
+            uint16_t noWriteRegisters,
+            const uint8_t* data);
+  Request17(const uint8_t* frame, size_t length);
+  virtual ResponseMessage* createResponse(Error error, uint8_t* data = nullptr, size_t len = 0) const;
+  virtual Error validate() const;
+};
+
+// request with a function code the library has no class for, the PDU
+// starts at data() + 7. A successful response carries data after the
+// function code as is; handlers normally answer ILLEGAL_FUNCTION.
+class RequestFrame : public RequestMessage {
+ public:
+  RequestFrame(const uint8_t* frame, size_t length);
+  virtual ResponseMessage* createResponse(Error error, uint8_t* data = nullptr, size_t len = 0) const;
+  virtual Error validate() const;
 };
 
 class ResponseMessage : public Message {
+ public:
+  Error error() const;
+  const uint8_t* values() const;
+  size_t valuesLength() const;
+
  protected:
   ResponseMessage(uint16_t transactionId,
                  size_t length,
                 uint8_t slaveId);
+  ResponseMessage(const uint8_t* frame, size_t length);
+};
+
+// response as received by a master, any function code
+class ResponseFrame : public ResponseMessage {
+ public:
+  ResponseFrame(const uint8_t* frame, size_t length);
 };
 
 class Response01 : public ResponseMessage {
  public:
   Response01(uint16_t transaction,
              uint8_t slaveId,
-             uint8_t noCoils,
+             uint16_t noCoils,
              uint8_t* data,
              uint8_t len);
 };
@@ -119,7 +243,7 @@ class Response02 : public ResponseMessage {
  public:
   Response02(uint16_t transaction,
              uint8_t slaveId,
-             uint8_t noInputs,
+             uint16_t noInputs,
              uint8_t* data,
              uint8_t len);
 };
@@ -133,6 +257,56 @@ class Response03 : public ResponseMessage {
              uint8_t len);
 };
 
+class Response04 : public ResponseMessage {
+ public:
+  Response04(uint16_t transaction,
+             uint8_t slaveId,
+             uint8_t noRegisters,
+             uint8_t* data,
+             uint8_t len);
+};
+
+class Response05 : public ResponseMessage {
+ public:
+  Response05(uint16_t transaction,
+             uint8_t slaveId,
+             uint16_t address,
+             uint16_t value);
+};
+
+class Response06 : public ResponseMessage {
+ public:
+  Response06(uint16_t transaction,
+             uint8_t slaveId,
+             uint16_t address,
+             uint16_t value);
+};
+
+class Response0F : public ResponseMessage {
+ public:
+  Response0F(uint16_t transaction,
+             uint8_t slaveId,
+             uint16_t address,
+             uint16_t noCoils);
+};
+
+class Response10 : public ResponseMessage {
+ public:
+  Response10(uint16_t transaction,
+             uint8_t slaveId,
+             uint16_t address,
+             uint16_t noRegisters);
+};
+
+class Response17 : public ResponseMessage {
+ public:
+  Response17(uint16_t transaction,
+             uint8_t slaveId,
+             uint8_t noRegisters,
+             uint8_t* data,
+             uint8_t len);
+};
+
 class ResponseError : public ResponseMessage {
  public:
   ResponseError(uint16_t transaction,
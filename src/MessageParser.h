@@ -26,15 +26,17 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #pragma once
 
 #include <algorithm>  // std::min
+#include <cstdint>  // SIZE_MAX
+#include <cstring>  // memmove
 
 #include <esp32-hal-log.h>
 
 #include "Message.h"
-#include "SimpleQueue.h"
 
 #ifndef PARSER_BUFFER_LENGTH
 #define PARSER_BUFFER_LENGTH 265  // 256 data + 7 MBAP + 1 FC + 1 LEN
 #endif
+static_assert(PARSER_BUFFER_LENGTH >= MAX_ADU_LENGTH, "PARSER_BUFFER_LENGTH can't hold the largest frame");
 
 
 namespace espModbus {
@@ -43,60 +45,333 @@ template <class T>
 class MessageParser {
  public:
   MessageParser() :
-    _buffer(PARSER_BUFFER_LENGTH) {}
+    _buffer{0},
+    _dropped{0},
+    _head(0),
+    _tail(0),
+    _start(0),
+    _more(false),
+    _outOfMemory(false) {}
 
+  // returns the number of bytes taken from data, at most one message is
+  // created (or dropped) per call: call again (len may be 0) to get
+  // pipelined messages
   size_t parse(uint8_t* data, size_t len, T& message) {  //NOLINT (non const reference)
-    // shortest message is 12 bytes, so try to copy in chuncks of 12 bytes
-    size_t length = std::min(PARSER_BUFFER_LENGTH - _buffer.size(), len);
-    for (size_t i = 0; i < length; ++i) {
-      _buffer.push(data[i]);
+    _outOfMemory = false;
+    // keep frames contiguous so they can be handed over in one copy
+    if (_head > 0 && PARSER_BUFFER_LENGTH - _tail < len) {
+      memmove(_buffer, &_buffer[_head], _tail - _head);
+      _start = _start >= _head ? _start - _head : SIZE_MAX;
+      _tail -= _head;
+      _head = 0;
     }
+    // new data starts a frame, unless it completes one
+    if (len > 0 && !_more && (_start != _head || !_headerStart(_head))) _start = _tail;
+    size_t length = std::min(PARSER_BUFFER_LENGTH - _tail, len);
+    memcpy(&_buffer[_tail], data, length);
+    _tail += length;
+    _more = length < len;  // rest of data follows in the next call
+    message = nullptr;
 
-    while (_buffer.size() >= 12) {
-      if (_buffer[2] != 0 ||  // high byte protocol
-          _buffer[3] != 0 ||  // low byte protocol
-          _buffer[4] != 0) {  // high byte length == 0, length is max 256
+    while (_size() >= _minimumLength()) {
+      uint8_t* frame = &_buffer[_head];
+      size_t frameLength = _frameLength(frame);
+      if (frameLength == 0) {
         log_w("protocol error");
-        _buffer.pop();
+        _resync();
         continue;
       }
-      if (
-          _buffer[5] == 6 &&
-          _buffer[11] < 123) {
-        switch (_buffer[7]) {
-          case READ_COILS:
-            message = new Request01((_buffer[0] << 8 | _buffer[1]),
-                                     _buffer[6],
-                                    (_buffer[8] << 8 | _buffer[9]),
-                                    _buffer[11]);
-            _buffer.pop(12);
-            break;
-          case READ_DISCR_INPUTS:
-            message = new Request02((_buffer[0] << 8 | _buffer[1]),
-                                     _buffer[6],
-                                    (_buffer[8] << 8 | _buffer[9]),
-                                    _buffer[11]);
-            _buffer.pop(12);
-            break;
-          case READ_HOLD_REGISTERS:
-            message = new Request03((_buffer[0] << 8 | _buffer[1]),
-                                     _buffer[6],
-                                    (_buffer[8] << 8 | _buffer[9]),
-                                    _buffer[11]);
-            _buffer.pop(12);
-            break;
+      if (!_supported(frame[7])) {
+        int followed = _followed(frameLength);
+        if (followed < 0) break;  // wait for rest of frame or next header
+        if (followed == 0) {
+          log_w("protocol error");
+          _resync();
+          continue;
         }
-        log_v("modbus message valid");
-      } else {
-        _buffer.pop();
+      }
+      if (_size() < frameLength) break;  // wait for rest of frame
+      if (!_wellFormed(frame)) {
+        // byte count doesn't match length
+        log_w("malformed message");
+        _resync();
         continue;
       }
+      message = _create(frame, frameLength);
+      if (!message) {
+        log_e("out of memory, message dropped");
+        memcpy(_dropped, frame, sizeof(_dropped));
+        _outOfMemory = true;
+      }
+      _pop(frameLength);
+      _start = _head;
+      return length;
     }
     return length;
   }
 
+  // MBAP header and function code of the frame the last call to parse()
+  // had no memory for, nullptr if there was none
+  const uint8_t* dropped() const {
+    return _outOfMemory ? _dropped : nullptr;
+  }
+
+  // exactly one well formed frame
+  static bool isFrame(const uint8_t* frame, size_t len) {
+    return len >= _minimumLength() && _frameLength(frame) == len && _wellFormed(frame);
+  }
+
+  // one complete frame, as carried by a datagram: nothing is buffered and
+  // anything but exactly one well formed frame is rejected
+  static T parseFrame(const uint8_t* frame, size_t len) {
+    if (!isFrame(frame, len)) return nullptr;
+    T message = _create(frame, len);
+    if (!message) {
+      log_e("out of memory, message dropped");
+    }
+    return message;
+  }
+
  private:
-  SimpleQueue<uint8_t> _buffer;
+  size_t _size() const {
+    return _tail - _head;
+  }
+
+  // MBAP header and function code give the length of a request
+  static size_t _minimumLength() {
+    return 8;
+  }
+
+  // total length of the frame if frame starts with a plausible MBAP
+  // header, 0 otherwise. Unknown function codes only need room for the
+  // unit id and function code, they are answered ILLEGAL_FUNCTION.
+  // Their length can't be checked, see _followed().
+  static size_t _frameLength(const uint8_t* frame) {
+    if (frame[2] != 0 ||  // high byte protocol
+        frame[3] != 0 ||  // low byte protocol
+        frame[4] != 0 ||  // high byte length == 0, length is max 256
+        frame[5] > MAX_ADU_LENGTH - 6) {
+      return 0;
+    }
+    switch (frame[7]) {
+      case READ_COILS:
+      case READ_DISCR_INPUTS:
+      case READ_HOLD_REGISTERS:
+      case READ_INPUT_REGISTERS:
+      case WRITE_COIL:
+      case WRITE_HOLD_REGISTER:
+        if (frame[5] != 6) return 0;
+        break;
+      case WRITE_MULT_COILS:
+      case WRITE_MULT_REGISTERS:
+        if (frame[5] < 7 + 1) return 0;
+        break;
+      case READ_WRITE_MULT_REGISTERS:
+        if (frame[5] < 11 + 2) return 0;
+        break;
+      default:
+        if (frame[5] < 2) return 0;
+        break;
+    }
+    return frame[5] + 6;  // length counts from slave id
+  }
+
+  static bool _supported(uint8_t fc) {
+    switch (fc) {
+      case READ_COILS:
+      case READ_DISCR_INPUTS:
+      case READ_HOLD_REGISTERS:
+      case READ_INPUT_REGISTERS:
+      case WRITE_COIL:
+      case WRITE_HOLD_REGISTER:
+      case WRITE_MULT_COILS:
+      case WRITE_MULT_REGISTERS:
+      case READ_WRITE_MULT_REGISTERS:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // garbage easily passes for a frame with an unknown function code, its
+  // length can't be checked. Such a frame is only taken where a frame
+  // starts without resync: at the start of received data or right after
+  // the previous frame. No header of a supported function code may start
+  // inside of it and it has to end the received data or be followed by
+  // such a header, pipelined frames of unknown function codes in between.
+  // Returns 1 to take the frame, 0 to resync and -1 to wait for more data.
+  int _followed(size_t frameLength) const {
+    if (_head != _start) return 0;
+    size_t end = _head + frameLength;
+    for (size_t i = _head + 1; i < end && i + _minimumLength() <= _tail; ++i) {
+      if (_header(i)) return 0;  // real frames hide in this one
+    }
+    if (_tail < end) return -1;  // wait for the rest of the frame
+    while (end + _minimumLength() <= _tail) {
+      if (_header(end)) return 1;
+      size_t length = _frameLength(&_buffer[end]);
+      if (length == 0) return 0;
+      end += length;
+    }
+    if (end == _tail && !_more) return 1;
+    if (!_headerStart(end)) return 0;
+    // wait for the next header as long as it fits in the buffer
+    return end + _minimumLength() - _head <= PARSER_BUFFER_LENGTH ? -1 : 1;
+  }
+
+  // protocol and high byte of length are zero, as far as received
+  bool _headerStart(size_t i) const {
+    for (size_t j = i + 2; j < i + 5 && j < _tail; ++j) {
+      if (_buffer[j] != 0) return false;
+    }
+    return true;
+  }
+
+  bool _header(size_t i) const {
+    return _supported(_buffer[i + 7]) && _frameLength(&_buffer[i]) != 0;
+  }
+
+  // byte count has to match the length in the header
+  static bool _wellFormed(const uint8_t* frame) {
+    switch (frame[7]) {
+      case WRITE_MULT_COILS:
+      case WRITE_MULT_REGISTERS:
+        return frame[5] == 7 + frame[12];
+      case READ_WRITE_MULT_REGISTERS:
+        return frame[5] == 11 + frame[16];
+      default:
+        return true;
+    }
+  }
+
+  static T _create(const uint8_t* frame, size_t length) {
+    switch (frame[7]) {
+      case READ_COILS:
+        return new Request01(frame, length);
+      case READ_DISCR_INPUTS:
+        return new Request02(frame, length);
+      case READ_HOLD_REGISTERS:
+        return new Request03(frame, length);
+      case READ_INPUT_REGISTERS:
+        return new Request04(frame, length);
+      case WRITE_COIL:
+        return new Request05(frame, length);
+      case WRITE_HOLD_REGISTER:
+        return new Request06(frame, length);
+      case WRITE_MULT_COILS:
+        return new Request0F(frame, length);
+      case WRITE_MULT_REGISTERS:
+        return new Request10(frame, length);
+      case READ_WRITE_MULT_REGISTERS:
+        return new Request17(frame, length);
+      default:
+        return new RequestFrame(frame, length);
+    }
+  }
+
+  // drop at least one byte and skip to the next position that can start a
+  // header: protocol id and high byte of length have to be zero.
+  // Input without zero bytes is skipped a word at a time, so every byte
+  // is looked at a bounded number of times.
+  void _resync() {
+    size_t i = _head + 1 + 2;  // protocol byte of the next candidate
+    while (i + 2 < _tail) {
+      if (i + 4 <= _tail) {
+        uint32_t word;
+        memcpy(&word, &_buffer[i], 4);
+        if (((word - 0x01010101UL) & ~word & 0x80808080UL) == 0) {  // no zero byte in word
+          i += 4;
+          continue;
+        }
+      }
+      if (_buffer[i] == 0 && _buffer[i + 1] == 0 && _buffer[i + 2] == 0) break;
+      ++i;
+    }
+    _pop(std::min(i, _tail) - 2 - _head);
+  }
+
+  void _pop(size_t qty) {
+    _head += qty;
+    if (_head == _tail) {
+      _head = 0;
+      _tail = 0;
+      _start = SIZE_MAX;
+    }
+  }
+
+  uint8_t _buffer[PARSER_BUFFER_LENGTH];
+  uint8_t _dropped[8];  // MBAP + function code
+  size_t _head;
+  size_t _tail;
+  size_t _start;  // where a frame starts without resync, SIZE_MAX if nowhere
+  bool _more;  // the last call couldn't take all data
+  bool _outOfMemory;
 };
 
+// Masters parse responses with the same buffering and resync, only the
+// framing rules differ.
+
+// shortest response is an exception: 9 bytes
+template <>
+inline size_t MessageParser<ResponseMessage*>::_minimumLength() {
+  return 9;
+}
+
+// _frameLength() already rejects unknown function codes
+template <>
+inline bool MessageParser<ResponseMessage*>::_supported(uint8_t) {
+  return true;
+}
+
+template <>
+inline size_t MessageParser<ResponseMessage*>::_frameLength(const uint8_t* frame) {
+  if (frame[2] != 0 ||  // high byte protocol
+      frame[3] != 0 ||  // low byte protocol
+      frame[4] != 0 ||  // high byte length == 0, length is max 256
+      frame[5] > MAX_ADU_LENGTH - 6) {
+    return 0;
+  }
+  if (frame[7] & 0x80) {
+    if (frame[5] != 3) return 0;
+    return 9;
+  }
+  switch (frame[7]) {
+    case READ_COILS:
+    case READ_DISCR_INPUTS:
+    case READ_HOLD_REGISTERS:
+    case READ_INPUT_REGISTERS:
+    case READ_WRITE_MULT_REGISTERS:
+      if (frame[5] < 3) return 0;
+      break;
+    case WRITE_COIL:
+    case WRITE_HOLD_REGISTER:
+    case WRITE_MULT_COILS:
+    case WRITE_MULT_REGISTERS:
+      if (frame[5] != 6) return 0;
+      break;
+    default:
+      return 0;
+  }
+  return frame[5] + 6;
+}
+
+template <>
+inline bool MessageParser<ResponseMessage*>::_wellFormed(const uint8_t* frame) {
+  switch (frame[7]) {
+    case READ_COILS:
+    case READ_DISCR_INPUTS:
+    case READ_HOLD_REGISTERS:
+    case READ_INPUT_REGISTERS:
+    case READ_WRITE_MULT_REGISTERS:
+      return frame[5] == 3 + frame[8];
+    default:
+      return true;
+  }
+}
+
+template <>
+inline ResponseMessage* MessageParser<ResponseMessage*>::_create(const uint8_t* frame, size_t length) {
+  return new ResponseFrame(frame, length);
+}
+
 }  // end namespace espModbus
@@ -0,0 +1,317 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include "ModbusTCPMaster.h"
+
+#include <algorithm>  // for std::max
+#include <cstring>  // for memcmp
+
+ModbusTCPMaster::ModbusTCPMaster(IPAddress ip, uint16_t port) :
+  _client(),
+  _ip(ip),
+  _port(port),
+  _connected(false),
+  _receiving(false),
+  _parser(),
+  _lock(nullptr),
+  _timeoutTimer(nullptr),
+  _transactions(),
+  _transactionId(0),
+  _sequence(0),
+  _maxInFlight(MAX_MASTER_TRANSACTIONS),
+  _inFlight(0) {
+    _lock = xSemaphoreCreateRecursiveMutex();
+    _client.onConnect(_onConnect, this);
+    _client.onData(_onData, this);
+    _client.onPoll(_onPoll, this);
+    _client.onDisconnect(_onDisconnect, this);
+    _client.onError(_onError, this);
+    TickType_t period = std::max(pdMS_TO_TICKS(MASTER_TIMEOUT_CHECK), static_cast<TickType_t>(1));
+    _timeoutTimer = xTimerCreate("modbus_timeouts", period, pdTRUE, this, _onTimeoutTimer);
+    if (_timeoutTimer) xTimerStart(_timeoutTimer, 0);
+}
+
+ModbusTCPMaster::~ModbusTCPMaster() {
+  if (_timeoutTimer) xTimerDelete(_timeoutTimer, portMAX_DELAY);
+  _client.onDisconnect(nullptr, nullptr);
+  _client.close(true);
+  xSemaphoreTakeRecursive(_lock, portMAX_DELAY);
+  _failAll(espModbus::COMM_ERROR);
+  // requests issued from those callbacks are dropped
+  for (size_t i = 0; i < MAX_MASTER_TRANSACTIONS; ++i) {
+    delete _transactions[i].request;
+  }
+  xSemaphoreGiveRecursive(_lock);
+  vSemaphoreDelete(_lock);
+}
+
+bool ModbusTCPMaster::connect() {
+  if (_connected) return true;
+  return _client.connect(_ip, _port);
+}
+
+void ModbusTCPMaster::disconnect() {
+  _client.close(false);
+}
+
+bool ModbusTCPMaster::connected() {
+  return _connected;
+}
+
+// requests the server handles concurrently, 1 disables pipelining
+void ModbusTCPMaster::setMaxInFlight(size_t maxInFlight) {
+  if (maxInFlight < 1) maxInFlight = 1;
+  if (maxInFlight > MAX_MASTER_TRANSACTIONS) maxInFlight = MAX_MASTER_TRANSACTIONS;
+  xSemaphoreTakeRecursive(_lock, portMAX_DELAY);
+  _maxInFlight = maxInFlight;
+  _transmit();
+  xSemaphoreGiveRecursive(_lock);
+}
+
+size_t ModbusTCPMaster::pending() const {
+  size_t count = 0;
+  for (size_t i = 0; i < MAX_MASTER_TRANSACTIONS; ++i) {
+    if (_transactions[i].request) ++count;
+  }
+  return count;
+}
+
+bool ModbusTCPMaster::send(espModbus::RequestMessage* request, espModbus::OnResponseCb callback, void* arg,
+                           uint32_t timeout) {
+  if (!request) return false;
+  xSemaphoreTakeRecursive(_lock, portMAX_DELAY);
+  for (size_t i = 0; i < MAX_MASTER_TRANSACTIONS; ++i) {
+    Transaction& t = _transactions[i];
+    if (t.request) continue;
+    uint16_t transactionId = _transactionId++;
+    request->data()[0] = espModbus::high(transactionId);
+    request->data()[1] = espModbus::low(transactionId);
+    t.request = request;
+    t.callback = callback;
+    t.arg = arg;
+    t.since = millis();
+    t.timeout = timeout;
+    t.sequence = _sequence++;
+    t.sent = false;
+    if (!_receiving) _transmit();  // else all at once after the last callback
+    xSemaphoreGiveRecursive(_lock);
+    return true;
+  }
+  xSemaphoreGiveRecursive(_lock);
+  log_w("too many pending requests");
+  delete request;
+  return false;
+}
+
+bool ModbusTCPMaster::readCoils(uint8_t unitId, uint16_t address, uint16_t noCoils,
+                                espModbus::OnResponseCb callback, void* arg, uint32_t timeout) {
+  return send(new espModbus::Request01(0, unitId, address, noCoils), callback, arg, timeout);
+}
+
+bool ModbusTCPMaster::readDiscreteInputs(uint8_t unitId, uint16_t address, uint16_t noInputs,
+                                         espModbus::OnResponseCb callback, void* arg, uint32_t timeout) {
+  return send(new espModbus::Request02(0, unitId, address, noInputs), callback, arg, timeout);
+}
+
+bool ModbusTCPMaster::readHoldingRegisters(uint8_t unitId, uint16_t address, uint16_t noRegisters,
+                                           espModbus::OnResponseCb callback, void* arg, uint32_t timeout) {
+  return send(new espModbus::Request03(0, unitId, address, noRegisters), callback, arg, timeout);
+}
+
+bool ModbusTCPMaster::readInputRegisters(uint8_t unitId, uint16_t address, uint16_t noRegisters,
+                                         espModbus::OnResponseCb callback, void* arg, uint32_t timeout) {
+  return send(new espModbus::Request04(0, unitId, address, noRegisters), callback, arg, timeout);
+}
+
+bool ModbusTCPMaster::writeCoil(uint8_t unitId, uint16_t address, bool value,
+                                espModbus::OnResponseCb callback, void* arg, uint32_t timeout) {
+  return send(new espModbus::Request05(0, unitId, address, value), callback, arg, timeout);
+}
+
+bool ModbusTCPMaster::writeRegister(uint8_t unitId, uint16_t address, uint16_t value,
+                                    espModbus::OnResponseCb callback, void* arg, uint32_t timeout) {
+  return send(new espModbus::Request06(0, unitId, address, value), callback, arg, timeout);
+}
+
+bool ModbusTCPMaster::writeRegisters(uint8_t unitId, uint16_t address, uint16_t noRegisters, const uint8_t* data,
+                                     espModbus::OnResponseCb callback, void* arg, uint32_t timeout) {
+  return send(new espModbus::Request10(0, unitId, address, noRegisters, data), callback, arg, timeout);
+}
+
+void ModbusTCPMaster::_onConnect(void* master, AsyncClient* /* client */) {
+  log_v("connected");
+  ModbusTCPMaster* m = static_cast<ModbusTCPMaster*>(master);
+  xSemaphoreTakeRecursive(m->_lock, portMAX_DELAY);
+  m->_connected = true;
+  m->_transmit();
+  xSemaphoreGiveRecursive(m->_lock);
+}
+
+void ModbusTCPMaster::_onData(void* master, AsyncClient* /* client */, void* data, size_t len) {
+  log_v("data rx - len: %d", len);
+  ModbusTCPMaster* m = static_cast<ModbusTCPMaster*>(master);
+  xSemaphoreTakeRecursive(m->_lock, portMAX_DELAY);
+  uint8_t* d = static_cast<uint8_t*>(data);
+  espModbus::ResponseMessage* response = nullptr;
+  m->_receiving = true;
+  while (true) {
+    size_t parsed = m->_parser.parse(d, len, response);
+    d += parsed;
+    len -= parsed;
+    if (response != nullptr) {
+      m->_receive(response);
+      delete response;
+      continue;
+    }
+    if (m->_parser.dropped()) continue;  // request times out
+    if (len == 0 || parsed == 0) break;
+  }
+  m->_checkTimeouts();
+  m->_receiving = false;
+  m->_transmit();
+  xSemaphoreGiveRecursive(m->_lock);
+}
+
+void ModbusTCPMaster::_onPoll(void* master, AsyncClient* /* client */) {
+  ModbusTCPMaster* m = static_cast<ModbusTCPMaster*>(master);
+  xSemaphoreTakeRecursive(m->_lock, portMAX_DELAY);
+  m->_checkTimeouts();
+  m->_transmit();
+  xSemaphoreGiveRecursive(m->_lock);
+}
+
+void ModbusTCPMaster::_onDisconnect(void* master, AsyncClient* /* client */) {
+  log_v("disconnected");
+  ModbusTCPMaster* m = static_cast<ModbusTCPMaster*>(master);
+  xSemaphoreTakeRecursive(m->_lock, portMAX_DELAY);
+  m->_connected = false;
+  m->_parser = espModbus::MessageParser<espModbus::ResponseMessage*>();
+  m->_failAll(espModbus::COMM_ERROR);
+  xSemaphoreGiveRecursive(m->_lock);
+}
+
+void ModbusTCPMaster::_onError(void* master, AsyncClient* /* client */, int8_t error) {
+  (void)error;  // only logged, which can be compiled out
+  log_e("connection error: %d", error);
+  ModbusTCPMaster* m = static_cast<ModbusTCPMaster*>(master);
+  xSemaphoreTakeRecursive(m->_lock, portMAX_DELAY);
+  m->_failAll(espModbus::COMM_ERROR);
+  xSemaphoreGiveRecursive(m->_lock);
+}
+
+void ModbusTCPMaster::_onTimeoutTimer(TimerHandle_t timer) {
+  ModbusTCPMaster* m = static_cast<ModbusTCPMaster*>(pvTimerGetTimerID(timer));
+  // busy handling traffic, which checks timeouts itself
+  if (xSemaphoreTakeRecursive(m->_lock, 0) != pdTRUE) return;
+  m->_checkTimeouts();
+  m->_transmit();
+  xSemaphoreGiveRecursive(m->_lock);
+}
+
+// Send waiting requests, oldest first, while the window allows. Requests
+// are only queued on the client and go out in as few segments as possible.
+void ModbusTCPMaster::_transmit() {
+  if (!_connected) return;
+  bool queued = false;
+  while (_inFlight < _maxInFlight) {
+    Transaction* next = nullptr;
+    for (size_t i = 0; i < MAX_MASTER_TRANSACTIONS; ++i) {
+      Transaction& t = _transactions[i];
+      if (t.request && !t.sent && (!next || static_cast<int32_t>(t.sequence - next->sequence) < 0)) next = &t;
+    }
+    if (!next || _client.space() < next->request->length()) break;
+    _client.add(reinterpret_cast<const char*>(next->request->data()), next->request->length());
+    next->sent = true;
+    ++_inFlight;
+    queued = true;
+  }
+  if (queued) _client.send();
+}
+
+// Match a response with its request. Responses to requests that already
+// timed out, or that never were, are dropped.
+void ModbusTCPMaster::_receive(espModbus::ResponseMessage* response) {
+  for (size_t i = 0; i < MAX_MASTER_TRANSACTIONS; ++i) {
+    Transaction& t = _transactions[i];
+    if (!t.request || !t.sent || t.request->transactionId() != response->transactionId()) continue;
+    const espModbus::RequestMessage& request = *t.request;
+    espModbus::Error error = response->error();
+    if (response->slaveId() != request.slaveId()) {
+      error = espModbus::INVALID_SLAVE;
+    } else if ((response->functionalCode() & 0x7F) != request.functionalCode()) {
+      error = espModbus::INVALID_FUNCTION;
+    } else if (error == espModbus::SUCCES) {
+      switch (request.functionalCode()) {
+        case espModbus::READ_COILS:
+        case espModbus::READ_DISCR_INPUTS:
+          if (response->valuesLength() != espModbus::coilsToBytes(request.noRegisters())) error = espModbus::COMM_ERROR;
+          break;
+        case espModbus::READ_HOLD_REGISTERS:
+        case espModbus::READ_INPUT_REGISTERS:
+        case espModbus::READ_WRITE_MULT_REGISTERS:
+          if (response->valuesLength() != espModbus::registersToBytes(request.noRegisters())) error = espModbus::COMM_ERROR;
+          break;
+        default:
+          // writes echo address and value or quantity
+          if (memcmp(&response->data()[8], &request.data()[8], 4) != 0) error = espModbus::COMM_ERROR;
+          break;
+      }
+    }
+    bool valid = (error == response->error());
+    _complete(i, error, valid ? response : nullptr);
+    return;
+  }
+  log_w("unexpected transaction %d", response->transactionId());
+}
+
+void ModbusTCPMaster::_checkTimeouts() {
+  uint32_t now = millis();
+  for (size_t i = 0; i < MAX_MASTER_TRANSACTIONS; ++i) {
+    Transaction& t = _transactions[i];
+    if (t.request && now - t.since >= t.timeout) {
+      log_w("transaction %d timed out", t.request->transactionId());
+      _complete(i, espModbus::TIMEOUT, nullptr);
+    }
+  }
+}
+
+void ModbusTCPMaster::_failAll(espModbus::Error error) {
+  for (size_t i = 0; i < MAX_MASTER_TRANSACTIONS; ++i) {
+    if (_transactions[i].request) _complete(i, error, nullptr);
+  }
+}
+
+// the slot is free before the callback runs, so it can issue the next request
+void ModbusTCPMaster::_complete(size_t index, espModbus::Error error, const espModbus::ResponseMessage* response) {
+  Transaction& t = _transactions[index];
+  espModbus::RequestMessage* request = t.request;
+  espModbus::OnResponseCb callback = t.callback;
+  void* arg = t.arg;
+  if (t.sent) --_inFlight;
+  t.request = nullptr;
+  t.callback = nullptr;
+  if (callback) callback(arg, error, *request, response);
+  delete request;
+}
@@ -0,0 +1,136 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#pragma once
+
+// general purpose
+#include <functional>  // std::function
+
+// framework
+#include <FreeRTOS.h>  // must appear before smphr.h
+#include <freertos/semphr.h>
+#include <freertos/timers.h>
+#include <esp32-hal.h>  // logging and millis()
+
+// external
+#include <AsyncTCP.h>
+
+// internal
+#include "Config.h"
+#include "Helpers.h"
+#include "MessageParser.h"
+#include "Message.h"
+
+namespace espModbus {
+#if MODBUS_STATIC_ALLOCATION
+typedef void (*OnResponseCb)(void*, Error, const Message&, const ResponseMessage*);
+#else
+typedef std::function<void(void*, Error, const Message&, const ResponseMessage*)> OnResponseCb;
+#endif
+}
+
+// Modbus TCP master for one server.
+//
+// Requests are pipelined: up to setMaxInFlight() transactions are
+// outstanding at once and responses are matched by transaction id, in
+// any order. Further requests wait in the transaction table and go out
+// as responses come in. Every request completes exactly once through its
+// callback, with the response (error is the exception code or SUCCES),
+// or with TIMEOUT or COMM_ERROR and no response.
+// Requests can be issued from any task, also from within a callback.
+// Callbacks run on the AsyncTCP task. Timeouts are checked on traffic
+// and every MASTER_TIMEOUT_CHECK ms from a timer, so requests issued
+// while not connected time out too. Their callbacks run on the timer
+// task.
+//
+// In the static allocation profile, add MAX_MASTER_TRANSACTIONS + 1 per
+// master to MAX_MODBUS_MESSAGES.
+class ModbusTCPMaster {
+ public:
+  explicit ModbusTCPMaster(IPAddress ip, uint16_t port = 502);
+  ~ModbusTCPMaster();
+  bool connect();
+  void disconnect();
+  bool connected();
+  void setMaxInFlight(size_t maxInFlight);
+  size_t pending() const;
+
+  // takes ownership of request, the transaction id is assigned here
+  bool send(espModbus::RequestMessage* request, espModbus::OnResponseCb callback, void* arg = nullptr,
+            uint32_t timeout = MASTER_TIMEOUT);
+  bool readCoils(uint8_t unitId, uint16_t address, uint16_t noCoils,
+                 espModbus::OnResponseCb callback, void* arg = nullptr, uint32_t timeout = MASTER_TIMEOUT);
+  bool readDiscreteInputs(uint8_t unitId, uint16_t address, uint16_t noInputs,
+                          espModbus::OnResponseCb callback, void* arg = nullptr, uint32_t timeout = MASTER_TIMEOUT);
+  bool readHoldingRegisters(uint8_t unitId, uint16_t address, uint16_t noRegisters,
+                            espModbus::OnResponseCb callback, void* arg = nullptr, uint32_t timeout = MASTER_TIMEOUT);
+  bool readInputRegisters(uint8_t unitId, uint16_t address, uint16_t noRegisters,
+                          espModbus::OnResponseCb callback, void* arg = nullptr, uint32_t timeout = MASTER_TIMEOUT);
+  bool writeCoil(uint8_t unitId, uint16_t address, bool value,
+                 espModbus::OnResponseCb callback, void* arg = nullptr, uint32_t timeout = MASTER_TIMEOUT);
+  bool writeRegister(uint8_t unitId, uint16_t address, uint16_t value,
+                     espModbus::OnResponseCb callback, void* arg = nullptr, uint32_t timeout = MASTER_TIMEOUT);
+  bool writeRegisters(uint8_t unitId, uint16_t address, uint16_t noRegisters, const uint8_t* data,
+                      espModbus::OnResponseCb callback, void* arg = nullptr, uint32_t timeout = MASTER_TIMEOUT);
+
+ private:
+  ModbusTCPMaster(const ModbusTCPMaster&) = delete;
+  ModbusTCPMaster& operator=(const ModbusTCPMaster&) = delete;
+  static void _onConnect(void* master, AsyncClient* client);
+  static void _onData(void* master, AsyncClient* client, void* data, size_t len);
+  static void _onPoll(void* master, AsyncClient* client);
+  static void _onDisconnect(void* master, AsyncClient* client);
+  static void _onError(void* master, AsyncClient* client, int8_t error);
+  static void _onTimeoutTimer(TimerHandle_t timer);
+  void _transmit();
+  void _receive(espModbus::ResponseMessage* response);
+  void _checkTimeouts();
+  void _failAll(espModbus::Error error);
+  void _complete(size_t index, espModbus::Error error, const espModbus::ResponseMessage* response);
+
+  struct Transaction {
+    espModbus::RequestMessage* request;  // nullptr: slot is free
+    espModbus::OnResponseCb callback;
+    void* arg;
+    uint32_t since;  // ms
+    uint32_t timeout;
+    uint32_t sequence;  // waiting requests go out in order
+    bool sent;
+  };
+
+  AsyncClient _client;
+  IPAddress _ip;
+  uint16_t _port;
+  bool _connected;
+  bool _receiving;  // requests issued from callbacks go out together
+  espModbus::MessageParser<espModbus::ResponseMessage*> _parser;
+  SemaphoreHandle_t _lock;
+  TimerHandle_t _timeoutTimer;
+  Transaction _transactions[MAX_MASTER_TRANSACTIONS];
+  uint16_t _transactionId;
+  uint32_t _sequence;
+  size_t _maxInFlight;
+  size_t _inFlight;
+};
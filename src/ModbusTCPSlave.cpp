@@ -29,17 +29,75 @@ uint8_t ModbusTCPSlave::_numberClients = 0;
 
 ModbusTCPSlave::ModbusTCPSlave(uint8_t slaveId, uint16_t port) :
   _server(port),
+  _udp(),
   _slaveId(slaveId),
   _semaphore(nullptr),
+  _lock(nullptr),
+  _connections{nullptr},
+  _nextConnection(0),
+  _rateLimits(),
+  _numberRateLimits(0),
+  _rate(0),
+  _burst(0),
+  _functionPriority{0},
+  _unitPriorities(),
+  _numberUnitPriorities(0),
+  _clientPriorities(),
+  _numberClientPriorities(0),
+  _latency(),
   _onRequestCb(nullptr),
-  _arg(nullptr) {
+  _onBatchCb(nullptr),
+  _batchArg(nullptr),
+#if defined(__cpp_impl_coroutine)
+  _onAsyncRequestCb(nullptr),
+  _asyncArg(nullptr),
+  _resumeQueue(nullptr),
+  _resumeTask(nullptr),
+  _resumeStopped(nullptr),
+#endif
+  _arg(nullptr),
+  _holdingRegisters(nullptr),
+  _registerChanges(nullptr),
+  _coilChanges(nullptr),
+  _changeTimer(nullptr),
+  _udpTimer(nullptr),
+  _capture(nullptr),
+  _requestCount(0),
+  _packetCount(0) {
     _semaphore = xSemaphoreCreateBinary();
     xSemaphoreGive(_semaphore);
+    _lock = xSemaphoreCreateRecursiveMutex();
+    // by default, writes go ahead of reads
+    for (size_t i = 0; i < sizeof(_functionPriority); ++i) {
+      _functionPriority[i] = (MODBUS_PRIORITY_CLASSES > 1) ? 1 : 0;
+    }
+    _functionPriority[espModbus::WRITE_COIL] = 0;
+    _functionPriority[espModbus::WRITE_HOLD_REGISTER] = 0;
+    _functionPriority[espModbus::WRITE_MULT_COILS] = 0;
+    _functionPriority[espModbus::WRITE_MULT_REGISTERS] = 0;
+    _functionPriority[espModbus::READ_WRITE_MULT_REGISTERS] = 0;
+#if defined(__cpp_impl_coroutine)
+    _resumeQueue = xQueueCreate(MAX_MODBUS_COROUTINES, sizeof(void*));
+#endif
 }
 
 ModbusTCPSlave::~ModbusTCPSlave() {
+#if defined(__cpp_impl_coroutine)
+  if (_resumeTask) {
+    // deleting the task could leave _lock taken: ask it to stop instead
+    void* stop = nullptr;
+    xQueueSend(_resumeQueue, &stop, portMAX_DELAY);
+    xSemaphoreTake(_resumeStopped, portMAX_DELAY);
+    vSemaphoreDelete(_resumeStopped);
+  }
+  vQueueDelete(_resumeQueue);
+#endif
   // destructor of _server will call _server.end();
   // TODO(bertmelis): what about current clients?
+  _udp.close();
+  if (_udpTimer) xTimerDelete(_udpTimer, portMAX_DELAY);
+  delete _connections[MAX_MODBUS_CLIENTS];
+  if (_changeTimer) xTimerDelete(_changeTimer, portMAX_DELAY);
 }
 
 void ModbusTCPSlave::onRequest(espModbus::OnRequestCb callback, void* arg) {
@@ -47,9 +105,121 @@ void ModbusTCPSlave::onRequest(espModbus::OnRequestCb callback, void* arg) {
   _arg = arg;
 }
 
+// Optional: gets all requests of a receive burst at once, so they can be
+// served with one pass over the data source. Responses are sent together.
+void ModbusTCPSlave::onBatch(espModbus::OnBatchCb callback, void* arg) {
+  _onBatchCb = callback;
+  _batchArg = arg;
+}
+
+#if defined(__cpp_impl_coroutine)
+void ModbusTCPSlave::onAsyncRequest(espModbus::OnAsyncRequestCb callback, void* arg) {
+  _onAsyncRequestCb = callback;
+  _asyncArg = arg;
+  if (callback && !_resumeTask) {
+    _resumeStopped = xSemaphoreCreateBinary();
+    xTaskCreate(_resumeCoroutines, "modbus_resume", COROUTINE_TASK_STACK, this, COROUTINE_TASK_PRIORITY, &_resumeTask);
+  }
+}
+#endif
+
+void ModbusTCPSlave::setHoldingRegisters(espModbus::RegisterBank* registers) {
+  _holdingRegisters = registers;
+}
+
+void ModbusTCPSlave::trackRegisterChanges(espModbus::ChangeTracker* tracker) {
+  _registerChanges = tracker;
+  _startChangeTimer();
+}
+
+void ModbusTCPSlave::trackCoilChanges(espModbus::ChangeTracker* tracker) {
+  _coilChanges = tracker;
+  _startChangeTimer();
+}
+
+// TCP clients get the default on their next connection, UDP peers without
+// a rule of their own right away
+void ModbusTCPSlave::setRateLimit(uint32_t rate, uint32_t burst) {
+  xSemaphoreTakeRecursive(_lock, portMAX_DELAY);
+  _rate = rate;
+  _burst = burst;
+  if (_connections[MAX_MODBUS_CLIENTS]) _connections[MAX_MODBUS_CLIENTS]->_bucket.configure(rate, burst, millis());
+  xSemaphoreGiveRecursive(_lock);
+}
+
+bool ModbusTCPSlave::setRateLimit(IPAddress ip, uint32_t rate, uint32_t burst) {
+  for (size_t i = 0; i < _numberRateLimits; ++i) {
+    if (_rateLimits[i].ip == ip) {
+      _rateLimits[i].rate = rate;
+      _rateLimits[i].burst = burst;
+      _rateLimits[i].datagrams.configure(rate, burst, millis());
+      return true;
+    }
+  }
+  if (_numberRateLimits == MAX_RATE_LIMITS) return false;
+  _rateLimits[_numberRateLimits] = {ip, rate, burst, espModbus::TokenBucket()};
+  _rateLimits[_numberRateLimits++].datagrams.configure(rate, burst, millis());
+  return true;
+}
+
+void ModbusTCPSlave::setPriority(espModbus::FunctionalCode fc, uint8_t priority) {
+  if (fc >= sizeof(_functionPriority) || priority >= MODBUS_PRIORITY_CLASSES) return;
+  _functionPriority[fc] = priority;
+}
+
+bool ModbusTCPSlave::setUnitPriority(uint8_t unitId, uint8_t priority) {
+  if (priority >= MODBUS_PRIORITY_CLASSES) return false;
+  for (size_t i = 0; i < _numberUnitPriorities; ++i) {
+    if (_unitPriorities[i].unitId == unitId) {
+      _unitPriorities[i].priority = priority;
+      return true;
+    }
+  }
+  if (_numberUnitPriorities == MAX_PRIORITY_RULES) return false;
+  _unitPriorities[_numberUnitPriorities++] = {unitId, priority};
+  return true;
+}
+
+bool ModbusTCPSlave::setClientPriority(IPAddress ip, uint8_t priority) {
+  if (priority >= MODBUS_PRIORITY_CLASSES) return false;
+  for (size_t i = 0; i < _numberClientPriorities; ++i) {
+    if (_clientPriorities[i].ip == ip) {
+      _clientPriorities[i].priority = priority;
+      return true;
+    }
+  }
+  if (_numberClientPriorities == MAX_PRIORITY_RULES) return false;
+  _clientPriorities[_numberClientPriorities++] = {ip, priority};
+  return true;
+}
+
+espModbus::LatencyStats ModbusTCPSlave::getLatency(uint8_t priority) const {
+  espModbus::LatencyStats stats = {0, 0, 0};
+  if (priority >= MODBUS_PRIORITY_CLASSES) return stats;
+  stats.count = _latency[priority].count;
+  stats.max = _latency[priority].max;
+  if (stats.count > 0) stats.average = _latency[priority].total / stats.count;
+  return stats;
+}
+
+void ModbusTCPSlave::resetLatency() {
+  for (size_t i = 0; i < MODBUS_PRIORITY_CLASSES; ++i) {
+    _latency[i] = {0, 0, 0};
+  }
+}
+
+// record inbound traffic of all connections, nullptr stops recording
+void ModbusTCPSlave::capture(espModbus::TrafficCapture* capture) {
+  _capture = capture;
+}
+
 void ModbusTCPSlave::begin() {
-  if (!_onRequestCb) {
-    log_e("onRequest callback mandatory, aborting");
+  bool handler = _onRequestCb || _onBatchCb || _holdingRegisters;
+#if defined(__cpp_impl_coroutine)
+  handler = handler || _onAsyncRequestCb;
+#endif
+  if (!handler) {
+    log_e("onRequest or onBatch callback or register bank mandatory, aborting");
     abort();
   }
   _server.setNoDelay(true);
@@ -57,19 +227,71 @@ void ModbusTCPSlave::begin() {
   _server.begin();
 }
 
+// Modbus over UDP: one request per datagram, served next to the TCP
+// clients with the same handlers. Per address rate limits and client
+// priorities apply to each sender.
+bool ModbusTCPSlave::beginUdp(uint16_t port) {
+  if (_connections[MAX_MODBUS_CLIENTS]) return true;
+  espModbus::Connection* conn = new espModbus::Connection(this, &_udp);
+  if (!conn) return false;
+  conn->_bucket.configure(_rate, _burst, millis());
+  if (!_udpTimer) _udpTimer = xTimerCreate("modbus_udp", 1, pdFALSE, this, _onUdpTimer);
+  if (!_udpTimer || !_udp.listen(port)) {
+    delete conn;
+    return false;
+  }
+  _connections[MAX_MODBUS_CLIENTS] = conn;
+  return true;
+}
+
 uint8_t ModbusTCPSlave::getId() const {
   return _slaveId;
 }
 
+uint32_t ModbusTCPSlave::getRequestCount() const {
+  return _requestCount;
+}
+
+uint32_t ModbusTCPSlave::getPacketCount() const {
+  return _packetCount;
+}
+
+float ModbusTCPSlave::getPacketsPerRequest() const {
+  if (_requestCount == 0) return 0.0f;
+  return static_cast<float>(_packetCount) / _requestCount;
+}
+
 void ModbusTCPSlave::_onClientConnect(void* slave, AsyncClient* client) {
   log_v("new client");
   ModbusTCPSlave* s = static_cast<ModbusTCPSlave*>(slave);
+  xSemaphoreTakeRecursive(s->_lock, portMAX_DELAY);
   if (xSemaphoreTake(s->_semaphore, 500) == pdTRUE) {
     if (_numberClients < MAX_MODBUS_CLIENTS) {
-      _numberClients++;
       espModbus::Connection* conn = new espModbus::Connection(s, client);
       if (conn != nullptr) {
+        _numberClients++;
+        uint32_t rate = s->_rate;
+        uint32_t burst = s->_burst;
+        for (size_t i = 0; i < s->_numberRateLimits; ++i) {
+          if (s->_rateLimits[i].ip == client->remoteIP()) {
+            rate = s->_rateLimits[i].rate;
+            burst = s->_rateLimits[i].burst;
+          }
+        }
+        conn->_bucket.configure(rate, burst, millis());
+        conn->_clientPriority = s->_clientPriority(client->remoteIP());
+        for (size_t i = 0; i < MAX_MODBUS_CLIENTS; ++i) {
+          if (!s->_connections[i]) {
+            s->_connections[i] = conn;
+            conn->_id = i;
+            break;
+          }
+        }
+        IPAddress ip = client->remoteIP();
+        uint8_t address[4] = {ip[0], ip[1], ip[2], ip[3]};
+        conn->_record(espModbus::capture::CONNECT, address, sizeof(address));
         xSemaphoreGive(s->_semaphore);
+        xSemaphoreGiveRecursive(s->_lock);
         return;
       }
     }
@@ -81,16 +303,238 @@ void ModbusTCPSlave::_onClientConnect(void* slave, AsyncClient* client) {
     client->close(true);
     delete client;
   }
+  xSemaphoreGiveRecursive(s->_lock);
 }
 
 void ModbusTCPSlave::_onClientDisconnect(ModbusTCPSlave* c, espModbus::Connection* conn) {
   if (xSemaphoreTake(c->_semaphore, 500) == pdTRUE) {
     c->_numberClients--;
+    for (size_t i = 0; i < MAX_MODBUS_CLIENTS; ++i) {
+      if (c->_connections[i] == conn) c->_connections[i] = nullptr;
+    }
     delete conn;
     xSemaphoreGive(c->_semaphore);
   }
 }
 
-void ModbusTCPSlave::_onRequest(const espModbus::Connection& connection) {
-  _onRequestCb(_arg, connection);
+void ModbusTCPSlave::_onRequest(espModbus::Connection& connection) {  // NOLINT (non const reference)
+  if (_holdingRegisters && _serveHoldingRegisters(connection)) return;
+#if defined(__cpp_impl_coroutine)
+  if (_onAsyncRequestCb) {
+    connection._startCoroutine(_onAsyncRequestCb(_asyncArg, connection.request()));
+    return;
+  }
+#endif
+  if (_onRequestCb) {
+    _onRequestCb(_arg, connection);
+  } else {
+    connection.respond(espModbus::ILLEGAL_FUNCTION);
+  }
+}
+
+bool ModbusTCPSlave::_serveHoldingRegisters(const espModbus::Connection& connection) {
+  const espModbus::Message& request = connection.request();
+  switch (request.functionalCode()) {
+    case espModbus::READ_HOLD_REGISTERS:
+      {
+      uint8_t data[250];  // max 125 registers
+      espModbus::Error error = _holdingRegisters->read(request.slaveId(), request.address(), request.noRegisters(), data);
+      connection.respond(error, data, espModbus::registersToBytes(request.noRegisters()));
+      return true;
+      }
+    case espModbus::WRITE_HOLD_REGISTER:
+      connection.respond(_holdingRegisters->write(request.slaveId(), request.address(), 1, request.payload()));
+      return true;
+    case espModbus::WRITE_MULT_REGISTERS:
+      connection.respond(_holdingRegisters->write(request.slaveId(), request.address(), request.noRegisters(), request.payload()));
+      return true;
+    case espModbus::READ_WRITE_MULT_REGISTERS:
+      {
+      uint8_t data[250];  // max 125 registers
+      espModbus::Error error = _holdingRegisters->readWrite(request.slaveId(),
+                                                            request.address(), request.noRegisters(), data,
+                                                            request.writeAddress(), request.noWriteRegisters(), request.payload());
+      connection.respond(error, data, espModbus::registersToBytes(request.noRegisters()));
+      return true;
+      }
+    default:
+      return false;
+  }
+}
+
+// Serve pending requests of all connections, best score first. The score
+// is the priority class minus the time waited, in units of PRIORITY_AGING.
+// On equal scores, connections take turns so one client with a full queue
+// can't starve the others. Across connections a request only ages from
+// the last time its connection was served, so a client keeping its queue
+// full doesn't get ahead of a client sending one request at a time.
+// The UDP listener takes part as one more connection.
+void ModbusTCPSlave::_service() {
+  for (size_t i = 0; i < MAX_MODBUS_CLIENTS + 1; ++i) {
+    if (_connections[i]) _connections[i]->_coalescing = (MAX_COALESCE_DELAY > 0);
+  }
+  uint32_t start = millis();
+  while (MAX_SERVICE_TIME == 0 || millis() - start < MAX_SERVICE_TIME) {
+    // responses of earlier requests don't wait for the rest of the pass
+    for (size_t i = 0; i < MAX_MODBUS_CLIENTS + 1; ++i) {
+      if (_connections[i]) _connections[i]->_flushOverdue();
+    }
+    uint32_t now = micros();
+    espModbus::Connection* best = nullptr;
+    size_t bestConnection = 0;
+    size_t bestIndex = 0;
+    int32_t bestScore = INT32_MAX;
+    for (size_t i = 0; i < MAX_MODBUS_CLIENTS + 1; ++i) {
+      size_t n = (_nextConnection + i) % (MAX_MODBUS_CLIENTS + 1);
+      espModbus::Connection* c = _connections[n];
+      int32_t score = 0;
+      size_t index = 0;
+      if (!c || !c->_next(now, &score, &index)) continue;
+      // waiting before the connection was last served doesn't count
+      int32_t early = static_cast<int32_t>(c->_lastServed - c->_queue[index].since);
+      if (early > 0) score += early;
+      if (score < bestScore) {
+        best = c;
+        bestConnection = n;
+        bestIndex = index;
+        bestScore = score;
+      }
+    }
+    if (!best) break;
+    best->_serve(bestIndex);
+    _nextConnection = (bestConnection + 1) % (MAX_MODBUS_CLIENTS + 1);
+  }
+  for (size_t i = 0; i < MAX_MODBUS_CLIENTS + 1; ++i) {
+    if (_connections[i]) {
+      _connections[i]->_coalescing = false;
+      _connections[i]->_flush();
+    }
+  }
+}
+
+void ModbusTCPSlave::_recordLatency(uint8_t priority, uint32_t since) {
+  uint32_t latency = micros() - since;
+  Latency& stats = _latency[priority];
+  ++stats.count;
+  stats.total += latency;
+  if (latency > stats.max) stats.max = latency;
+}
+
+// -1 if there is no rule for this client
+int16_t ModbusTCPSlave::_clientPriority(IPAddress ip) const {
+  for (size_t i = 0; i < _numberClientPriorities; ++i) {
+    if (_clientPriorities[i].ip == ip) return _clientPriorities[i].priority;
+  }
+  return -1;
+}
+
+// rate limit of a datagram's sender, nullptr if there is no rule for it
+espModbus::TokenBucket* ModbusTCPSlave::_datagramBucket(IPAddress ip) {
+  for (size_t i = 0; i < _numberRateLimits; ++i) {
+    if (_rateLimits[i].ip == ip) return &_rateLimits[i].datagrams;
+  }
+  return nullptr;
+}
+
+// most specific rule wins: client, unit id, function code
+uint8_t ModbusTCPSlave::_priority(const espModbus::Message& request, int16_t clientPriority) const {
+  if (clientPriority >= 0) return clientPriority;
+  for (size_t i = 0; i < _numberUnitPriorities; ++i) {
+    if (_unitPriorities[i].unitId == request.slaveId()) return _unitPriorities[i].priority;
+  }
+  if (request.functionalCode() < sizeof(_functionPriority)) return _functionPriority[request.functionalCode()];
+  return MODBUS_PRIORITY_CLASSES - 1;
+}
+
+void ModbusTCPSlave::_onWritten(const espModbus::Message& request) {
+  switch (request.functionalCode()) {
+    case espModbus::WRITE_COIL:
+      if (_coilChanges) _coilChanges->mark(request.address(), 1);
+      break;
+    case espModbus::WRITE_MULT_COILS:
+      if (_coilChanges) _coilChanges->mark(request.address(), request.noRegisters());
+      break;
+    case espModbus::WRITE_HOLD_REGISTER:
+      if (_registerChanges) _registerChanges->mark(request.address(), 1);
+      break;
+    case espModbus::WRITE_MULT_REGISTERS:
+      if (_registerChanges) _registerChanges->mark(request.address(), request.noRegisters());
+      break;
+    case espModbus::READ_WRITE_MULT_REGISTERS:
+      if (_registerChanges) _registerChanges->mark(request.writeAddress(), request.noWriteRegisters());
+      break;
+    default:
+      break;
+  }
+}
+
+// only called with the lock held and outside of _respond(), so change
+// callbacks never run while a response is being built
+void ModbusTCPSlave::_deliverChanges() {
+  if (_registerChanges) _registerChanges->deliver();
+  if (_coilChanges) _coilChanges->deliver();
+}
+
+// changes go out after their interval even when no more traffic comes
+// in, whatever the transport
+void ModbusTCPSlave::_startChangeTimer() {
+  uint32_t interval = UINT32_MAX;
+  if (_registerChanges) interval = std::min(interval, _registerChanges->interval());
+  if (_coilChanges) interval = std::min(interval, _coilChanges->interval());
+  if (interval == UINT32_MAX) return;
+  TickType_t period = std::max(pdMS_TO_TICKS(interval), static_cast<TickType_t>(1));
+  if (_changeTimer) {
+    xTimerChangePeriod(_changeTimer, period, 0);
+    return;
+  }
+  _changeTimer = xTimerCreate("modbus_changes", period, pdTRUE, this, _onChangeTimer);
+  if (_changeTimer) xTimerStart(_changeTimer, 0);
+}
+
+void ModbusTCPSlave::_onChangeTimer(TimerHandle_t timer) {
+  ModbusTCPSlave* s = static_cast<ModbusTCPSlave*>(pvTimerGetTimerID(timer));
+  // don't hold up the timer task, a busy slave delivers after its callbacks
+  if (xSemaphoreTakeRecursive(s->_lock, 0) != pdTRUE) return;
+  s->_deliverChanges();
+  xSemaphoreGiveRecursive(s->_lock);
+}
+
+// continues UDP passes that ran out of time, one tick after the last one
+// so TCP callbacks get the lock in between
+void ModbusTCPSlave::_onUdpTimer(TimerHandle_t timer) {
+  ModbusTCPSlave* s = static_cast<ModbusTCPSlave*>(pvTimerGetTimerID(timer));
+  // don't hold up the timer task, try again on the next tick
+  if (xSemaphoreTakeRecursive(s->_lock, 0) != pdTRUE) {
+    xTimerStart(timer, 0);
+    return;
+  }
+  s->_service();
+  if (s->_connections[MAX_MODBUS_CLIENTS]->_pending()) xTimerStart(timer, 0);
+  s->_deliverChanges();
+  xSemaphoreGiveRecursive(s->_lock);
+}
+
+#if defined(__cpp_impl_coroutine)
+// completions only queue the handler, it is resumed here under the lock so
+// the reply doesn't wait for the next network event. A null handle comes
+// from the destructor: the task leaves with the lock released.
+void ModbusTCPSlave::_resumeCoroutines(void* slave) {
+  ModbusTCPSlave* s = static_cast<ModbusTCPSlave*>(slave);
+  void* handle = nullptr;
+  bool running = true;
+  while (running && xQueueReceive(s->_resumeQueue, &handle, portMAX_DELAY) == pdTRUE) {
+    xSemaphoreTakeRecursive(s->_lock, portMAX_DELAY);
+    do {
+      if (!handle) {
+        running = false;
+        break;
+      }
+      std::coroutine_handle<espModbus::Task::promise_type>::from_address(handle).resume();
+    } while (xQueueReceive(s->_resumeQueue, &handle, 0) == pdTRUE);
+    s->_deliverChanges();
+    xSemaphoreGiveRecursive(s->_lock);
+  }
+  xSemaphoreGive(s->_resumeStopped);
+  vTaskDelete(nullptr);
 }
+#endif
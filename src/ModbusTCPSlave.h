@@ -25,19 +25,6 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #pragma once
 
-// unit: times 500ms
-#ifndef CLIENT_KEEPALIVE
-#define CLIENT_KEEPALIVE 120
-#endif
-
-#ifndef MAX_MODBUS_CLIENTS
-#define MAX_MODBUS_CLIENTS 3
-#endif
-
-#ifndef MAX_MODBUS_REQUESTS
-#define MAX_MODBUS_REQUESTS 5
-#endif
-
 // general purpose
 #include <functional>  // std::function
 #include <utility>  // std::move
@@ -45,42 +32,149 @@ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 // framework
 #include <FreeRTOS.h>  // must appear before smphr.h
 #include <freertos/semphr.h>
+#include <freertos/timers.h>
 #include <esp32-hal.h>  // logging and millis()
 
 // external
 #include <AsyncTCP.h>
+#include <AsyncUDP.h>
 
 // internal
+#include "Config.h"
 #include "Helpers.h"
 #include "MessageParser.h"
 #include "Message.h"
+#include "TokenBucket.h"
+#include "RegisterBank.h"
+#include "ChangeTracker.h"
+#include "Coroutine.h"
+#include "TrafficCapture.h"
 
 namespace espModbus {
 class Request;
 class Connection;
+class Batch;
+#if MODBUS_STATIC_ALLOCATION
+typedef void (*OnRequestCb)(void*, const espModbus::Connection&);
+typedef void (*OnBatchCb)(void*, espModbus::Batch&);
+#else
 typedef std::function<void(void*, const espModbus::Connection&)> OnRequestCb;
+typedef std::function<void(void*, espModbus::Batch&)> OnBatchCb;
+#endif
+
+// time from reception of a request until its handler returned, in us
+struct LatencyStats {
+  uint32_t count;
+  uint32_t average;
+  uint32_t max;
+};
 }
 class ModbusTCPSlave;
 
 namespace espModbus {
 
+// The requests received in one burst on a connection, handed to the batch
+// handler at once. Requests are ordered by priority class, then arrival.
+// Requests left unanswered by the batch handler stay queued and are
+// served by the scheduler like any other request.
+// A batch is only valid during the call of the batch handler.
+class Batch {
+  friend class Connection;
+
+ public:
+  size_t size() const;
+  const Message& request(size_t index) const;
+  bool respond(size_t index, Error error, uint8_t* data = nullptr, size_t len = 0);
+  bool answered(size_t index) const;
+
+ private:
+  explicit Batch(Connection* connection);
+  Connection* _connection;
+  size_t _size;
+  size_t _index[MAX_MODBUS_REQUESTS];  // into the connection's queue
+  bool _answered[MAX_MODBUS_REQUESTS];
+};
+
 class Connection {
+  friend class ::ModbusTCPSlave;
+  friend class Batch;
+#if defined(__cpp_impl_coroutine)
+  friend class Task::promise_type;
+#endif
+
  public:
   Connection(ModbusTCPSlave* slave, AsyncClient* client);
+  Connection(ModbusTCPSlave* slave, AsyncUDP* udp);
   ~Connection();
   const Message& request() const;
   bool respond(Error error, uint8_t* data = nullptr, size_t len = 0) const;
 
+#if MODBUS_STATIC_ALLOCATION
+  static void* operator new(size_t size) noexcept;
+  static void operator delete(void* p);
+#endif
+
  private:
   static void _onData(void* conn, AsyncClient* client, void* data, size_t len);
   static void _onPoll(void* conn, AsyncClient* client);
   static void _onDisconnect(void* conn, AsyncClient* client);
+  static void _onPacket(void* conn, AsyncUDPPacket& packet);  // NOLINT (non const reference)
+  bool _respond(const RequestMessage& request, Error error, uint8_t* data, size_t len) const;
+  static void _onAck(void* conn, AsyncClient* client, size_t len, uint32_t time);
+  void _accept();
+  bool _pending() const;
+  bool _next(uint32_t now, int32_t* score, size_t* index) const;
+  void _serve(size_t index);
+  void _serveBatch();
+  void _release(size_t index);
+  void _flush() const;
+  void _flushOverdue() const;
+  void _record(capture::RecordType type, const uint8_t* data = nullptr, size_t len = 0) const;
+  void _recordRequest() const;
+#if defined(__cpp_impl_coroutine)
+  void _startCoroutine(Task task);
+  void _coroutineReply(const Task::promise_type& promise, const Reply& reply);
+  void _coroutineDone(Task::promise_type* promise);
+#endif
+
+  // source of a datagram, where the response goes
+  struct Peer {
+    IPAddress ip;
+    uint16_t port;
+  };
+  const Peer& _peerOf(const RequestMessage& request) const;
+  void _respondBusy(const uint8_t* header, const Peer& peer) const;
+  bool _send(const uint8_t* data, size_t len, const Peer& peer) const;
 
   ModbusTCPSlave* _slave;
   AsyncClient* _client;
+  AsyncUDP* _udp;  // set instead of _client for the UDP listener
+  Peer _peer;  // of _currentRequest
+  uint8_t _id;  // connection number in captures
   MessageParser<RequestMessage*> _factory;
   RequestMessage* _currentRequest;
+  struct Pending {
+    RequestMessage* request;
+    uint32_t since;  // us
+    uint8_t priority;
+    Peer peer;
+  };
+  Pending _queue[MAX_MODBUS_REQUESTS];
+  size_t _received[MAX_MODBUS_REQUESTS];  // queue slots filled by this receive
+  size_t _numberReceived;
+  TokenBucket _bucket;
+  int16_t _clientPriority;  // -1: no rule for this client
+  uint32_t _lastServed;  // us
   uint8_t _keepaliveCount;
+  mutable bool _coalescing;
+  mutable size_t _pendingBytes;
+  mutable uint32_t _pendingSince;
+#if defined(__cpp_impl_coroutine)
+  Task::promise_type* _coroutines[MAX_MODBUS_REQUESTS];  // suspended handlers
+  Peer _coroutinePeers[MAX_MODBUS_REQUESTS];
+  uint32_t _currentSince;  // us, of _currentRequest
+  uint8_t _currentPriority;
+#endif
 };
 
 }  // end namespace espModbus
@@ -92,18 +186,129 @@ class ModbusTCPSlave {
   explicit ModbusTCPSlave(uint8_t slaveId, uint16_t port = 502);
   ~ModbusTCPSlave();
   void onRequest(espModbus::OnRequestCb callback, void* arg = nullptr);
+  void onBatch(espModbus::OnBatchCb callback, void* arg = nullptr);
+#if defined(__cpp_impl_coroutine)
+  void onAsyncRequest(espModbus::OnAsyncRequestCb callback, void* arg = nullptr);
+#endif
+  void setHoldingRegisters(espModbus::RegisterBank* registers);
+  void trackRegisterChanges(espModbus::ChangeTracker* tracker);
+  void trackCoilChanges(espModbus::ChangeTracker* tracker);
+  void setRateLimit(uint32_t rate, uint32_t burst);
+  bool setRateLimit(IPAddress ip, uint32_t rate, uint32_t burst);
+  void setPriority(espModbus::FunctionalCode fc, uint8_t priority);
+  bool setUnitPriority(uint8_t unitId, uint8_t priority);
+  bool setClientPriority(IPAddress ip, uint8_t priority);
+  espModbus::LatencyStats getLatency(uint8_t priority) const;
+  void resetLatency();
+  void capture(espModbus::TrafficCapture* capture);
   void begin();
+  bool beginUdp(uint16_t port = 502);
   uint8_t getId() const;
+  uint32_t getRequestCount() const;
+  // packets are TCP sends, one per batch of responses that may take
+  // several segments, and UDP datagrams
+  uint32_t getPacketCount() const;
+  float getPacketsPerRequest() const;
 
  private:
   static void _onClientConnect(void* arg, AsyncClient* client);
   static void _onClientDisconnect(ModbusTCPSlave* c, espModbus::Connection* conn);
-  void _onRequest(const espModbus::Connection& connection);
+  void _onRequest(espModbus::Connection& connection);  // NOLINT (non const reference)
+  bool _serveHoldingRegisters(const espModbus::Connection& connection);
+  void _service();
+  void _recordLatency(uint8_t priority, uint32_t since);
+  uint8_t _priority(const espModbus::Message& request, int16_t clientPriority) const;
+  int16_t _clientPriority(IPAddress ip) const;
+  espModbus::TokenBucket* _datagramBucket(IPAddress ip);
+  void _onWritten(const espModbus::Message& request);
+  void _deliverChanges();
+  void _startChangeTimer();
+  static void _onChangeTimer(TimerHandle_t timer);
+  static void _onUdpTimer(TimerHandle_t timer);
+#if defined(__cpp_impl_coroutine)
+  static void _resumeCoroutines(void* slave);
+#endif
 
   AsyncServer _server;
+  AsyncUDP _udp;
   uint8_t _slaveId;
   SemaphoreHandle_t _semaphore;
+  SemaphoreHandle_t _lock;  // TCP and UDP callbacks run on different tasks
   static uint8_t _numberClients;
+  espModbus::Connection* _connections[MAX_MODBUS_CLIENTS + 1];  // last one is the UDP listener
+  size_t _nextConnection;
+  struct RateLimit {
+    IPAddress ip;
+    uint32_t rate;
+    uint32_t burst;
+    espModbus::TokenBucket datagrams;  // UDP peers share the listener
+  };
+  RateLimit _rateLimits[MAX_RATE_LIMITS];
+  size_t _numberRateLimits;
+  uint32_t _rate;
+  uint32_t _burst;
+  uint8_t _functionPriority[32];
+  struct UnitPriority {
+    uint8_t unitId;
+    uint8_t priority;
+  };
+  UnitPriority _unitPriorities[MAX_PRIORITY_RULES];
+  size_t _numberUnitPriorities;
+  struct ClientPriority {
+    IPAddress ip;
+    uint8_t priority;
+  };
+  ClientPriority _clientPriorities[MAX_PRIORITY_RULES];
+  size_t _numberClientPriorities;
+  struct Latency {
+    uint32_t count;
+    uint64_t total;
+    uint32_t max;
+  };
+  Latency _latency[MODBUS_PRIORITY_CLASSES];
   espModbus::OnRequestCb _onRequestCb;
+  espModbus::OnBatchCb _onBatchCb;
+  void* _batchArg;
+#if defined(__cpp_impl_coroutine)
+  espModbus::OnAsyncRequestCb _onAsyncRequestCb;
+  void* _asyncArg;
+  QueueHandle_t _resumeQueue;
+  TaskHandle_t _resumeTask;
+  SemaphoreHandle_t _resumeStopped;  // given by the task when it leaves
+#endif
   void* _arg;
+  espModbus::RegisterBank* _holdingRegisters;
+  espModbus::ChangeTracker* _registerChanges;
+  espModbus::ChangeTracker* _coilChanges;
+  TimerHandle_t _changeTimer;
+  TimerHandle_t _udpTimer;  // continues UDP passes
+  espModbus::TrafficCapture* _capture;
+  uint32_t _requestCount;
+  uint32_t _packetCount;
 };
+
+#if MODBUS_STATIC_ALLOCATION
+namespace espModbus {
+
+typedef StaticPool<sizeof(Connection), MAX_MODBUS_CLIENTS + 1> ConnectionPool;  // + UDP
+
+// bytes of static storage used by the library, AsyncTCP's own
+// allocations for its clients are not included
+namespace footprint {
+constexpr size_t connections = ConnectionPool::footprint();
+constexpr size_t messages = MessagePool::footprint();
+constexpr size_t slave = sizeof(ModbusTCPSlave);
+#if defined(__cpp_impl_coroutine)
+constexpr size_t coroutines = CoroutinePool::footprint();
+#else
+constexpr size_t coroutines = 0;
+#endif
+constexpr size_t total = connections + messages + slave + coroutines;
+}  // end namespace footprint
+
+}  // end namespace espModbus
+
+#ifdef MODBUS_MEMORY_BUDGET
+static_assert(espModbus::footprint::total <= MODBUS_MEMORY_BUDGET, "espModbus exceeds MODBUS_MEMORY_BUDGET");
+#endif
+#endif
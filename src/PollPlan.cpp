@@ -0,0 +1,255 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include "PollPlan.h"
+
+#include <algorithm>  // std::sort
+
+#include "Helpers.h"
+
+namespace espModbus {
+
+TagValues::TagValues(const uint8_t* data, uint16_t bitOffset, uint16_t count) :
+  _data(data),
+  _bitOffset(bitOffset),
+  _count(count) {}
+
+uint16_t TagValues::count() const {
+  return _count;
+}
+
+uint16_t TagValues::value(uint16_t index) const {
+  return _data[index * 2] << 8 | _data[index * 2 + 1];
+}
+
+bool TagValues::bit(uint16_t index) const {
+  uint16_t bit = _bitOffset + index;
+  return _data[bit / 8] & (1 << (bit % 8));
+}
+
+const uint8_t* TagValues::data() const {
+  return _data;
+}
+
+PollPlan::PollPlan(size_t maxTags, size_t maxForbidden) :
+  _tags(nullptr),
+  _forbiddenRanges(nullptr),
+  _order(nullptr),
+  _requests(nullptr),
+  _maxTags(maxTags),
+  _maxForbidden(maxForbidden),
+  _numberTags(0),
+  _numberForbidden(0),
+  _numberRequests(0),
+  _unitLimits(),
+  _numberLimits(0) {
+    _tags = new Tag[_maxTags];
+    _forbiddenRanges = new Tag[_maxForbidden];
+    _order = new size_t[_maxTags];
+    _requests = new Request[_maxTags];  // never more requests than tags
+    if (!_tags || !_forbiddenRanges || !_order || !_requests) {
+      log_e("out of memory");
+      _maxTags = _maxForbidden = 0;
+    }
+}
+
+PollPlan::~PollPlan() {
+  delete[] _tags;
+  delete[] _forbiddenRanges;
+  delete[] _order;
+  delete[] _requests;
+}
+
+// returns the tag id, -1 when the tag can't be polled
+int PollPlan::add(uint8_t unitId, FunctionalCode fc, uint16_t address, uint16_t count) {
+  if (_numberTags == _maxTags) {
+    log_e("no room for more tags");
+    return -1;
+  }
+  uint16_t maxQuantity = 0;
+  uint16_t maxGap = 0;
+  _limits(unitId, fc, &maxQuantity, &maxGap);
+  if (count == 0 || count > maxQuantity || static_cast<uint32_t>(address) + count > 0x10000) {
+    log_e("tag %d/%d of unit %d can't be read in one request", address, count, unitId);
+    return -1;
+  }
+  _tags[_numberTags] = {unitId, fc, address, count, 0};
+  _numberRequests = 0;  // plan has to be rebuilt
+  return _numberTags++;
+}
+
+// addresses that must not be read, typically holes in the device's map
+bool PollPlan::forbid(uint8_t unitId, FunctionalCode fc, uint16_t address, uint16_t count) {
+  if (_numberForbidden == _maxForbidden || count == 0) return false;
+  _forbiddenRanges[_numberForbidden++] = {unitId, fc, address, count, 0};
+  _numberRequests = 0;
+  return true;
+}
+
+// maxQuantity 0 keeps the protocol maximum of the function code, fails
+// when a tag added before doesn't fit in one request anymore
+bool PollPlan::setLimits(uint8_t unitId, uint16_t maxQuantity, uint16_t maxGap) {
+  for (size_t i = 0; maxQuantity > 0 && i < _numberTags; ++i) {
+    if (_tags[i].unitId == unitId && _tags[i].count > maxQuantity) {
+      log_e("tag %d/%d of unit %d exceeds limit %d", _tags[i].address, _tags[i].count, unitId, maxQuantity);
+      return false;
+    }
+  }
+  for (size_t i = 0; i < _numberLimits; ++i) {
+    if (_unitLimits[i].unitId == unitId) {
+      _unitLimits[i].maxQuantity = maxQuantity;
+      _unitLimits[i].maxGap = maxGap;
+      _numberRequests = 0;
+      return true;
+    }
+  }
+  if (_numberLimits == MAX_PLAN_LIMITS) return false;
+  _unitLimits[_numberLimits++] = {unitId, maxQuantity, maxGap};
+  _numberRequests = 0;
+  return true;
+}
+
+size_t PollPlan::build() {
+  for (size_t i = 0; i < _numberTags; ++i) _order[i] = i;
+  const Tag* tags = _tags;
+  std::sort(_order, _order + _numberTags, [tags](size_t a, size_t b) {
+    if (tags[a].unitId != tags[b].unitId) return tags[a].unitId < tags[b].unitId;
+    if (tags[a].fc != tags[b].fc) return tags[a].fc < tags[b].fc;
+    return tags[a].address < tags[b].address;
+  });
+  _numberRequests = 0;
+  Request* current = nullptr;
+  uint16_t maxQuantity = 0;
+  uint16_t maxGap = 0;
+  for (size_t i = 0; i < _numberTags; ++i) {
+    Tag& tag = _tags[_order[i]];
+    uint32_t last = static_cast<uint32_t>(tag.address) + tag.count - 1;
+    if (current && current->unitId == tag.unitId && current->fc == tag.fc) {
+      uint32_t end = static_cast<uint32_t>(current->address) + current->count;  // one past
+      uint32_t newLast = std::max(last, end - 1);
+      if (newLast - current->address + 1 <= maxQuantity &&
+          (tag.address <= end || tag.address - end <= maxGap) &&
+          (tag.address <= end || !_forbidden(tag.unitId, tag.fc, end, tag.address - 1))) {
+        current->count = newLast - current->address + 1;
+        ++current->numberTags;
+        tag.request = current - _requests;
+        continue;
+      }
+    }
+    _limits(tag.unitId, tag.fc, &maxQuantity, &maxGap);
+    current = &_requests[_numberRequests++];
+    *current = {tag.unitId, tag.fc, tag.address, tag.count, i, 1};
+    tag.request = current - _requests;
+  }
+  return _numberRequests;
+}
+
+size_t PollPlan::numberTags() const {
+  return _numberTags;
+}
+
+size_t PollPlan::numberRequests() const {
+  return _numberRequests;
+}
+
+const PollPlan::Request& PollPlan::request(size_t index) const {
+  return _requests[index];
+}
+
+// id of the index-th tag served by a request
+size_t PollPlan::tag(size_t request, size_t index) const {
+  return _order[_requests[request].firstTag + index];
+}
+
+RequestMessage* PollPlan::createRequest(size_t index, uint16_t transactionId) const {
+  const Request& r = _requests[index];
+  switch (r.fc) {
+    case READ_COILS:
+      return new Request01(transactionId, r.unitId, r.address, r.count);
+    case READ_DISCR_INPUTS:
+      return new Request02(transactionId, r.unitId, r.address, r.count);
+    case READ_HOLD_REGISTERS:
+      return new Request03(transactionId, r.unitId, r.address, r.count);
+    case READ_INPUT_REGISTERS:
+      return new Request04(transactionId, r.unitId, r.address, r.count);
+    default:
+      return nullptr;
+  }
+}
+
+// the tag's values inside the response to its request, count is 0 when
+// the response doesn't hold them
+TagValues PollPlan::values(size_t tag, const ResponseMessage& response) const {
+  const Tag& t = _tags[tag];
+  const Request& r = _requests[t.request];
+  uint16_t offset = t.address - r.address;
+  if (response.error() != SUCCES || !response.values()) return TagValues();
+  if (t.fc == READ_COILS || t.fc == READ_DISCR_INPUTS) {
+    if (coilsToBytes(offset + t.count) > response.valuesLength()) return TagValues();
+    return TagValues(response.values() + offset / 8, offset % 8, t.count);
+  }
+  if (static_cast<size_t>(offset + t.count) * 2 > response.valuesLength()) return TagValues();
+  return TagValues(response.values() + offset * 2, 0, t.count);
+}
+
+void PollPlan::_limits(uint8_t unitId, FunctionalCode fc, uint16_t* maxQuantity, uint16_t* maxGap) const {
+  *maxQuantity = _maxQuantity(fc);
+  *maxGap = UINT16_MAX;
+  for (size_t i = 0; i < _numberLimits; ++i) {
+    if (_unitLimits[i].unitId == unitId) {
+      if (_unitLimits[i].maxQuantity > 0 && _unitLimits[i].maxQuantity < *maxQuantity) {
+        *maxQuantity = _unitLimits[i].maxQuantity;
+      }
+      *maxGap = _unitLimits[i].maxGap;
+    }
+  }
+}
+
+bool PollPlan::_forbidden(uint8_t unitId, FunctionalCode fc, uint32_t first, uint32_t last) const {
+  for (size_t i = 0; i < _numberForbidden; ++i) {
+    const Tag& f = _forbiddenRanges[i];
+    if (f.unitId == unitId && f.fc == fc &&
+        f.address <= last && static_cast<uint32_t>(f.address) + f.count - 1 >= first) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// largest quantity a slave accepts, see RequestXX::validate()
+uint16_t PollPlan::_maxQuantity(FunctionalCode fc) {
+  switch (fc) {
+    case READ_COILS:
+    case READ_DISCR_INPUTS:
+      return 2000;
+    case READ_HOLD_REGISTERS:
+    case READ_INPUT_REGISTERS:
+      return 125;
+    default:
+      return 0;
+  }
+}
+
+}  // end namespace espModbus
@@ -0,0 +1,128 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stdint.h>  // for uint*_t
+#include <stddef.h>  // for size_t
+
+#include <esp32-hal-log.h>
+
+#include "Config.h"
+#include "TypeDefs.h"
+#include "Message.h"
+
+namespace espModbus {
+
+// Values of one tag inside a response, read in place.
+class TagValues {
+ public:
+  TagValues(const uint8_t* data = nullptr, uint16_t bitOffset = 0, uint16_t count = 0);
+  uint16_t count() const;
+  uint16_t value(uint16_t index) const;  // registers
+  bool bit(uint16_t index) const;  // coils and inputs
+  const uint8_t* data() const;  // registers as big endian bytes
+
+ private:
+  const uint8_t* _data;
+  uint16_t _bitOffset;
+  uint16_t _count;
+};
+
+// Merges the tags a master polls into as few read requests as possible.
+//
+// Tags of the same unit and function code are merged when the merged
+// request stays within the unit's maximum quantity, the gap between
+// tags is at most the unit's maximum gap and no forbidden range is read.
+// Tags are taken in address order and every request is extended as far
+// as possible, which gives the minimal number of requests.
+//
+//   PollPlan plan(200);
+//   int temperature = plan.add(1, READ_HOLD_REGISTERS, 100, 2);
+//   ...
+//   plan.build();
+//   for (size_t r = 0; r < plan.numberRequests(); ++r) {
+//     master.send(plan.createRequest(r), onResponse, reinterpret_cast<void*>(r));
+//   }
+//   // in onResponse, for each plan.tag(r, i): plan.values(tag, *response)
+class PollPlan {
+ public:
+  struct Request {
+    uint8_t unitId;
+    FunctionalCode fc;
+    uint16_t address;
+    uint16_t count;
+    size_t firstTag;  // position in the tag order
+    size_t numberTags;
+  };
+
+  explicit PollPlan(size_t maxTags, size_t maxForbidden = 16);
+  ~PollPlan();
+  int add(uint8_t unitId, FunctionalCode fc, uint16_t address, uint16_t count);
+  bool forbid(uint8_t unitId, FunctionalCode fc, uint16_t address, uint16_t count);
+  bool setLimits(uint8_t unitId, uint16_t maxQuantity, uint16_t maxGap);
+  size_t build();
+
+  size_t numberTags() const;
+  size_t numberRequests() const;
+  const Request& request(size_t index) const;
+  size_t tag(size_t request, size_t index) const;
+  RequestMessage* createRequest(size_t index, uint16_t transactionId = 0) const;
+  TagValues values(size_t tag, const ResponseMessage& response) const;
+
+ private:
+  PollPlan(const PollPlan&) = delete;
+  PollPlan& operator=(const PollPlan&) = delete;
+
+  struct Tag {
+    uint8_t unitId;
+    FunctionalCode fc;
+    uint16_t address;
+    uint16_t count;
+    size_t request;
+  };
+  struct Limits {
+    uint8_t unitId;
+    uint16_t maxQuantity;
+    uint16_t maxGap;
+  };
+  void _limits(uint8_t unitId, FunctionalCode fc, uint16_t* maxQuantity, uint16_t* maxGap) const;
+  bool _forbidden(uint8_t unitId, FunctionalCode fc, uint32_t first, uint32_t last) const;
+  static uint16_t _maxQuantity(FunctionalCode fc);
+
+  Tag* _tags;
+  Tag* _forbiddenRanges;
+  size_t* _order;  // tag ids sorted by unit, function code and address
+  Request* _requests;
+  size_t _maxTags;
+  size_t _maxForbidden;
+  size_t _numberTags;
+  size_t _numberForbidden;
+  size_t _numberRequests;
+  Limits _unitLimits[MAX_PLAN_LIMITS];
+  size_t _numberLimits;
+};
+
+}  // end namespace espModbus
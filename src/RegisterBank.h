@@ -0,0 +1,62 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stdint.h>  // for uint*_t
+
+#include "TypeDefs.h"
+
+namespace espModbus {
+
+// Built-in data model for holding registers. When attached to a slave,
+// register reads and writes are served from here instead of the onRequest
+// callback. Register values are passed as big endian bytes, exactly as
+// they appear in the Modbus frame, so bulk writes are handed over as one
+// span without conversion.
+class RegisterBank {
+ public:
+  virtual ~RegisterBank() {}
+  virtual Error read(uint8_t slaveId, uint16_t address, uint16_t noRegisters, uint8_t* data) = 0;
+  virtual Error write(uint8_t slaveId, uint16_t address, uint16_t noRegisters, const uint8_t* data) = 0;
+
+  // FC17: the write is applied before the read. The slave calls this once
+  // per request from the network task, so requests on other connections
+  // can't interleave. Override when the bank is also written from other
+  // tasks and the pair has to be atomic with respect to those as well.
+  // A first read checks the read range, so a request that fails doesn't
+  // write anything.
+  virtual Error readWrite(uint8_t slaveId,
+                          uint16_t readAddress, uint16_t noReadRegisters, uint8_t* readData,
+                          uint16_t writeAddress, uint16_t noWriteRegisters, const uint8_t* writeData) {
+    Error error = read(slaveId, readAddress, noReadRegisters, readData);
+    if (error != SUCCES) return error;
+    error = write(slaveId, writeAddress, noWriteRegisters, writeData);
+    if (error != SUCCES) return error;
+    return read(slaveId, readAddress, noReadRegisters, readData);
+  }
+};
+
+}  // end namespace espModbus
@@ -0,0 +1,165 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include "SnapshotRegisters.h"
+
+#include <cstring>  // for memset, memcpy
+
+#include "Helpers.h"
+
+namespace espModbus {
+
+SnapshotRegisters::SnapshotRegisters(uint16_t address, uint16_t noRegisters) :
+  _address(address),
+  _noRegisters(noRegisters),
+  _buffers{nullptr, nullptr},
+  _sequence(0),
+  _writeLock(nullptr),
+  _dirtyFirst(UINT16_MAX),
+  _dirtyLast(0) {
+    _buffers[0] = new uint16_t[_noRegisters];
+    _buffers[1] = new uint16_t[_noRegisters];
+    memset(_buffers[0], 0, _noRegisters * sizeof(uint16_t));
+    memset(_buffers[1], 0, _noRegisters * sizeof(uint16_t));
+    _writeLock = xSemaphoreCreateMutex();
+}
+
+SnapshotRegisters::~SnapshotRegisters() {
+  vSemaphoreDelete(_writeLock);
+  delete[] _buffers[0];
+  delete[] _buffers[1];
+}
+
+void SnapshotRegisters::beginUpdate() {
+  xSemaphoreTake(_writeLock, portMAX_DELAY);
+}
+
+void SnapshotRegisters::set(uint16_t address, uint16_t value) {
+  if (!_inRange(address, 1)) {
+    log_e("address %d out of range", address);
+    return;
+  }
+  _stage(address - _address, value);
+}
+
+void SnapshotRegisters::commit() {
+  _commit();
+  xSemaphoreGive(_writeLock);
+}
+
+void SnapshotRegisters::publish(uint16_t address, uint16_t noRegisters, const uint16_t* values) {
+  if (!_inRange(address, noRegisters)) {
+    log_e("range %d - %d out of range", address, address + noRegisters);
+    return;
+  }
+  beginUpdate();
+  for (uint16_t i = 0; i < noRegisters; ++i) {
+    _stage(address - _address + i, values[i]);
+  }
+  commit();
+}
+
+uint16_t SnapshotRegisters::get(uint16_t address) const {
+  uint8_t data[2] = {0};
+  if (_inRange(address, 1)) _copy(address - _address, 1, data);
+  return (data[0] << 8 | data[1]);
+}
+
+Error SnapshotRegisters::read(uint8_t /* slaveId */, uint16_t address, uint16_t noRegisters, uint8_t* data) {
+  if (!_inRange(address, noRegisters)) return ILLEGAL_DATA_ADDRESS;
+  _copy(address - _address, noRegisters, data);
+  return SUCCES;
+}
+
+Error SnapshotRegisters::write(uint8_t /* slaveId */, uint16_t address, uint16_t noRegisters, const uint8_t* data) {
+  if (!_inRange(address, noRegisters)) return ILLEGAL_DATA_ADDRESS;
+  if (xSemaphoreTake(_writeLock, SNAPSHOT_WRITE_TIMEOUT) != pdTRUE) return SERVER_DEVICE_BUSY;
+  for (uint16_t i = 0; i < noRegisters; ++i) {
+    _stage(address - _address + i, data[i * 2] << 8 | data[i * 2 + 1]);
+  }
+  commit();
+  return SUCCES;
+}
+
+Error SnapshotRegisters::readWrite(uint8_t /* slaveId */,
+                                   uint16_t readAddress, uint16_t noReadRegisters, uint8_t* readData,
+                                   uint16_t writeAddress, uint16_t noWriteRegisters, const uint8_t* writeData) {
+  if (!_inRange(readAddress, noReadRegisters) || !_inRange(writeAddress, noWriteRegisters)) return ILLEGAL_DATA_ADDRESS;
+  if (xSemaphoreTake(_writeLock, SNAPSHOT_WRITE_TIMEOUT) != pdTRUE) return SERVER_DEVICE_BUSY;
+  for (uint16_t i = 0; i < noWriteRegisters; ++i) {
+    _stage(writeAddress - _address + i, writeData[i * 2] << 8 | writeData[i * 2 + 1]);
+  }
+  _commit();
+  // holding the write lock: nobody can commit in between
+  _copy(readAddress - _address, noReadRegisters, readData);
+  xSemaphoreGive(_writeLock);
+  return SUCCES;
+}
+
+bool SnapshotRegisters::_inRange(uint16_t address, uint16_t noRegisters) const {
+  return address >= _address &&
+         static_cast<uint32_t>(address) + noRegisters <= static_cast<uint32_t>(_address) + _noRegisters;
+}
+
+// write lock must be held
+void SnapshotRegisters::_stage(uint16_t index, uint16_t value) {
+  uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+  _buffers[(sequence + 1) & 1][index] = value;
+  if (index < _dirtyFirst) _dirtyFirst = index;
+  if (index > _dirtyLast) _dirtyLast = index;
+}
+
+// write lock must be held
+void SnapshotRegisters::_commit() {
+  if (_dirtyFirst > _dirtyLast) return;
+  uint32_t sequence = _sequence.load(std::memory_order_relaxed) + 1;
+  _sequence.store(sequence, std::memory_order_release);
+  // the swap must be visible before the old buffer gets overwritten
+  std::atomic_thread_fence(std::memory_order_release);
+  // bring the new staging buffer up to date, only the staged range differs
+  memcpy(&_buffers[(sequence + 1) & 1][_dirtyFirst],
+         &_buffers[sequence & 1][_dirtyFirst],
+         (_dirtyLast - _dirtyFirst + 1) * sizeof(uint16_t));
+  _dirtyFirst = UINT16_MAX;
+  _dirtyLast = 0;
+}
+
+void SnapshotRegisters::_copy(uint16_t index, uint16_t noRegisters, uint8_t* data) const {
+  uint32_t before = 0;
+  uint32_t after = 0;
+  do {
+    before = _sequence.load(std::memory_order_acquire);
+    const uint16_t* buffer = _buffers[before & 1];
+    for (uint16_t i = 0; i < noRegisters; ++i) {
+      uint16_t value = buffer[index + i];
+      data[i * 2] = high(value);
+      data[i * 2 + 1] = low(value);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    after = _sequence.load(std::memory_order_relaxed);
+  } while (before != after);
+}
+
+}  // end namespace espModbus
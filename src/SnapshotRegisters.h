@@ -0,0 +1,92 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stdint.h>  // for uint*_t
+#include <atomic>
+
+#include <FreeRTOS.h>  // must appear before smphr.h
+#include <freertos/semphr.h>
+#include <esp32-hal-log.h>
+
+#include "RegisterBank.h"
+
+#ifndef SNAPSHOT_WRITE_TIMEOUT
+#define SNAPSHOT_WRITE_TIMEOUT 10  // ticks a master write waits for the application
+#endif
+
+namespace espModbus {
+
+// Double buffered holding registers for values shared between the
+// application and the network task.
+//
+// Writers stage changes in the inactive buffer and publish them with
+// commit(), which swaps the buffers. Readers copy from the active buffer
+// and retry only when a commit happened during their copy (seqlock), so
+// they never block and never see half of a multi register value.
+// Writers never wait for readers; concurrent writers are serialized.
+//
+//   registers.beginUpdate();
+//   registers.set(10, high);
+//   registers.set(11, low);
+//   registers.commit();
+class SnapshotRegisters : public RegisterBank {
+ public:
+  SnapshotRegisters(uint16_t address, uint16_t noRegisters);
+  ~SnapshotRegisters();
+
+  // application side
+  void beginUpdate();
+  void set(uint16_t address, uint16_t value);
+  void commit();
+  void publish(uint16_t address, uint16_t noRegisters, const uint16_t* values);
+  uint16_t get(uint16_t address) const;
+
+  // network side
+  virtual Error read(uint8_t slaveId, uint16_t address, uint16_t noRegisters, uint8_t* data);
+  virtual Error write(uint8_t slaveId, uint16_t address, uint16_t noRegisters, const uint8_t* data);
+  virtual Error readWrite(uint8_t slaveId,
+                          uint16_t readAddress, uint16_t noReadRegisters, uint8_t* readData,
+                          uint16_t writeAddress, uint16_t noWriteRegisters, const uint8_t* writeData);
+
+ private:
+  SnapshotRegisters(const SnapshotRegisters&) = delete;
+  SnapshotRegisters& operator=(const SnapshotRegisters&) = delete;
+  bool _inRange(uint16_t address, uint16_t noRegisters) const;
+  void _stage(uint16_t index, uint16_t value);
+  void _commit();
+  void _copy(uint16_t index, uint16_t noRegisters, uint8_t* data) const;
+
+  uint16_t _address;
+  uint16_t _noRegisters;
+  uint16_t* _buffers[2];
+  std::atomic<uint32_t> _sequence;  // active buffer is _sequence & 1
+  SemaphoreHandle_t _writeLock;
+  uint16_t _dirtyFirst;
+  uint16_t _dirtyLast;
+};
+
+}  // end namespace espModbus
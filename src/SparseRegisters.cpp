@@ -0,0 +1,200 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include "SparseRegisters.h"
+
+#include <cstring>  // for memset, memcpy, memmove
+
+#include "Helpers.h"
+
+namespace espModbus {
+
+SparseRegisters::SparseRegisters(size_t maxRanges, size_t maxRegisters) :
+  _ranges(nullptr),
+  _values(nullptr),
+  _maxRanges(maxRanges),
+  _maxRegisters(maxRegisters),
+  _numberRanges(0),
+  _numberRegisters(0) {
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+    _mux = mux;
+    _ranges = new Range[_maxRanges];
+    _values = new uint8_t[_maxRegisters * 2];
+    if (!_ranges || !_values) {
+      log_e("out of memory");
+      _maxRanges = _maxRegisters = 0;
+      return;
+    }
+    memset(_values, 0, _maxRegisters * 2);
+}
+
+SparseRegisters::~SparseRegisters() {
+  delete[] _ranges;
+  delete[] _values;
+}
+
+// Ranges are inserted in order. A range continuing the one before it,
+// with its values at the end of the storage, is merged: maps defined in
+// ascending order end up as few, long spans.
+bool SparseRegisters::add(uint8_t unitId, uint16_t address, uint16_t noRegisters) {
+  if (noRegisters == 0 || static_cast<uint32_t>(address) + noRegisters > 0x10000) return false;
+  if (_numberRegisters + noRegisters > _maxRegisters) {
+    log_e("no room for %d registers", noRegisters);
+    return false;
+  }
+  uint32_t first = static_cast<uint32_t>(unitId) << 16 | address;
+  uint32_t last = first + noRegisters - 1;
+  size_t index = _lookup(first);  // new range goes here
+  if ((index > 0 && _ranges[index - 1].last >= first) ||
+      (index < _numberRanges && _ranges[index].first <= last)) {
+    log_e("range %d - %d of unit %d overlaps", address, address + noRegisters - 1, unitId);
+    return false;
+  }
+  uint32_t offset = _numberRegisters * 2;
+  if (index > 0 &&
+      _ranges[index - 1].last + 1 == first &&
+      _ranges[index - 1].offset + (_ranges[index - 1].last - _ranges[index - 1].first + 1) * 2 == offset) {
+    _ranges[index - 1].last = last;
+  } else {
+    if (_numberRanges == _maxRanges) {
+      log_e("no room for more ranges");
+      return false;
+    }
+    memmove(&_ranges[index + 1], &_ranges[index], (_numberRanges - index) * sizeof(Range));
+    _ranges[index] = {first, last, offset};
+    ++_numberRanges;
+  }
+  _numberRegisters += noRegisters;
+  return true;
+}
+
+// big endian values, nullptr when the registers aren't one defined span
+const uint8_t* SparseRegisters::span(uint8_t unitId, uint16_t address, uint16_t noRegisters) const {
+  return _find(unitId, address, noRegisters);
+}
+
+bool SparseRegisters::set(uint8_t unitId, uint16_t address, uint16_t value) {
+  uint8_t* data = _find(unitId, address, 1);
+  if (!data) return false;
+  portENTER_CRITICAL(&_mux);
+  data[0] = high(value);
+  data[1] = low(value);
+  portEXIT_CRITICAL(&_mux);
+  return true;
+}
+
+uint16_t SparseRegisters::get(uint8_t unitId, uint16_t address) const {
+  const uint8_t* data = _find(unitId, address, 1);
+  if (!data) return 0;
+  portENTER_CRITICAL(&_mux);
+  uint16_t value = data[0] << 8 | data[1];
+  portEXIT_CRITICAL(&_mux);
+  return value;
+}
+
+size_t SparseRegisters::numberRanges() const {
+  return _numberRanges;
+}
+
+size_t SparseRegisters::numberRegisters() const {
+  return _numberRegisters;
+}
+
+// bytes allocated, including unused capacity
+size_t SparseRegisters::footprint() const {
+  return sizeof(*this) + _maxRanges * sizeof(Range) + _maxRegisters * 2;
+}
+
+Error SparseRegisters::read(uint8_t slaveId, uint16_t address, uint16_t noRegisters, uint8_t* data) {
+  return _transfer(slaveId, address, noRegisters, data, nullptr) ? SUCCES : ILLEGAL_DATA_ADDRESS;
+}
+
+Error SparseRegisters::write(uint8_t slaveId, uint16_t address, uint16_t noRegisters, const uint8_t* data) {
+  return _transfer(slaveId, address, noRegisters, nullptr, data) ? SUCCES : ILLEGAL_DATA_ADDRESS;
+}
+
+// index + 1 of the last range starting at or before key, 0 if none
+size_t SparseRegisters::_lookup(uint32_t key) const {
+  size_t low = 0;
+  size_t high = _numberRanges;
+  while (low < high) {
+    size_t mid = (low + high) / 2;
+    if (_ranges[mid].first <= key) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+// the whole request has to fit in one range
+uint8_t* SparseRegisters::_find(uint8_t unitId, uint16_t address, uint16_t noRegisters) const {
+  if (noRegisters == 0) return nullptr;
+  uint32_t first = static_cast<uint32_t>(unitId) << 16 | address;
+  uint32_t last = first + noRegisters - 1;
+  size_t index = _lookup(first);
+  if (index == 0) return nullptr;
+  const Range& range = _ranges[index - 1];
+  if (last > range.last) return nullptr;  // hole, or next unit
+  return &_values[range.offset + (first - range.first) * 2];
+}
+
+// Copies registers out of (data) or into (values) the map. A request
+// may continue over adjacent ranges that couldn't be merged; any hole
+// fails it before anything is copied.
+bool SparseRegisters::_transfer(uint8_t unitId, uint16_t address, uint16_t noRegisters,
+                                uint8_t* data, const uint8_t* values) {
+  if (noRegisters == 0) return false;
+  uint32_t first = static_cast<uint32_t>(unitId) << 16 | address;
+  uint32_t last = first + noRegisters - 1;
+  size_t start = _lookup(first);
+  if (start == 0 || _ranges[start - 1].last < first) return false;
+  size_t end = start;  // one past the last range used
+  while (_ranges[end - 1].last < last) {
+    if (end == _numberRanges || _ranges[end].first != _ranges[end - 1].last + 1) return false;
+    ++end;
+  }
+  portENTER_CRITICAL(&_mux);
+  uint32_t key = first;
+  for (size_t i = start - 1; i < end; ++i) {
+    const Range& range = _ranges[i];
+    uint32_t to = range.last < last ? range.last : last;
+    size_t len = (to - key + 1) * 2;
+    uint8_t* span = &_values[range.offset + (key - range.first) * 2];
+    if (data) {
+      memcpy(data, span, len);
+      data += len;
+    } else {
+      memcpy(span, values, len);
+      values += len;
+    }
+    key = to + 1;
+  }
+  portEXIT_CRITICAL(&_mux);
+  return true;
+}
+
+}  // end namespace espModbus
@@ -0,0 +1,94 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stdint.h>  // for uint*_t
+#include <stddef.h>  // for size_t
+
+#include <FreeRTOS.h>  // portMUX
+#include <esp32-hal-log.h>
+
+#include "RegisterBank.h"
+
+namespace espModbus {
+
+// Holding registers of many simulated units with scattered addresses.
+//
+// Only defined ranges take memory: the ranges are kept sorted by unit id
+// and address, a lookup is a binary search. Values are stored as big
+// endian bytes, so a read within one range is a single copy from a
+// contiguous span. Reads and writes that touch an undefined address
+// return ILLEGAL_DATA_ADDRESS.
+// Adjacent ranges added in ascending order are merged into one span.
+// Storage for maxRanges ranges and maxRegisters registers is allocated
+// up front; define all ranges before the slave starts serving.
+//
+//   SparseRegisters registers(3 * 250, 103 * 250);
+//   registers.add(unit, 0, 1);       // 40001
+//   registers.add(unit, 999, 1);     // 41000
+//   registers.add(unit, 4999, 101);  // 45000 - 45100
+class SparseRegisters : public RegisterBank {
+ public:
+  SparseRegisters(size_t maxRanges, size_t maxRegisters);
+  ~SparseRegisters();
+
+  // application side
+  bool add(uint8_t unitId, uint16_t address, uint16_t noRegisters);
+  const uint8_t* span(uint8_t unitId, uint16_t address, uint16_t noRegisters) const;
+  bool set(uint8_t unitId, uint16_t address, uint16_t value);
+  uint16_t get(uint8_t unitId, uint16_t address) const;
+  size_t numberRanges() const;
+  size_t numberRegisters() const;
+  size_t footprint() const;
+
+  // network side
+  virtual Error read(uint8_t slaveId, uint16_t address, uint16_t noRegisters, uint8_t* data);
+  virtual Error write(uint8_t slaveId, uint16_t address, uint16_t noRegisters, const uint8_t* data);
+
+ private:
+  SparseRegisters(const SparseRegisters&) = delete;
+  SparseRegisters& operator=(const SparseRegisters&) = delete;
+
+  // unit id and address in one key, ranges never cross units
+  struct Range {
+    uint32_t first;
+    uint32_t last;  // inclusive
+    uint32_t offset;  // in _values, bytes
+  };
+  size_t _lookup(uint32_t key) const;
+  uint8_t* _find(uint8_t unitId, uint16_t address, uint16_t noRegisters) const;
+  bool _transfer(uint8_t unitId, uint16_t address, uint16_t noRegisters, uint8_t* data, const uint8_t* values);
+
+  Range* _ranges;
+  uint8_t* _values;
+  size_t _maxRanges;
+  size_t _maxRegisters;
+  size_t _numberRanges;
+  size_t _numberRegisters;
+  mutable portMUX_TYPE _mux;
+};
+
+}  // end namespace espModbus
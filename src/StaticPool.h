@@ -0,0 +1,127 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+/**
+ * @file StaticPool.h
+ * @brief StaticPool API
+ *
+ * Fixed size object pool
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <FreeRTOS.h>
+
+/**
+ * @brief Pool of equally sized memory slots in static storage.
+ *
+ * Used as backend for class specific `operator new` in the static
+ * allocation profile. Allocation and release are O(1) and safe to call
+ * from different tasks.
+ *
+ * @tparam SlotSize Size of one slot in bytes.
+ * @tparam Slots Number of slots.
+ */
+template <size_t SlotSize, size_t Slots>
+class StaticPool {
+ public:
+  /**
+   * @brief Construct a new StaticPool object with all slots free.
+   */
+  StaticPool() :
+    _free(nullptr),
+    _available(Slots) {
+      portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+      _mux = mux;
+      for (size_t i = 0; i < Slots; ++i) {
+        _slots[i].next = _free;
+        _free = &_slots[i];
+      }
+    }
+
+  /**
+   * @brief Take a slot from the pool.
+   *
+   * @param size Requested size in bytes.
+   * @return void* Pointer to the slot, nullptr if the pool is exhausted
+   *               or size doesn't fit in a slot.
+   */
+  void* allocate(size_t size) {
+    if (size > SlotSize) return nullptr;
+    Slot* slot = nullptr;
+    portENTER_CRITICAL(&_mux);
+    if (_free) {
+      slot = _free;
+      _free = slot->next;
+      --_available;
+    }
+    portEXIT_CRITICAL(&_mux);
+    return slot;
+  }
+
+  /**
+   * @brief Return a slot to the pool.
+   *
+   * @param p Pointer obtained from `allocate()`, nullptr is ignored.
+   */
+  void release(void* p) {
+    if (!p) return;
+    Slot* slot = static_cast<Slot*>(p);
+    portENTER_CRITICAL(&_mux);
+    slot->next = _free;
+    _free = slot;
+    ++_available;
+    portEXIT_CRITICAL(&_mux);
+  }
+
+  /**
+   * @brief Return the number of free slots.
+   *
+   * @return size_t number of free slots.
+   */
+  size_t available() const {
+    return _available;
+  }
+
+  /**
+   * @brief Total storage used by a pool of this type.
+   */
+  static constexpr size_t footprint() {
+    return sizeof(StaticPool<SlotSize, Slots>);
+  }
+
+ private:
+  union Slot {
+    Slot* next;
+    alignas(8) uint8_t data[SlotSize];
+  };
+  Slot _slots[Slots];
+  Slot* _free;
+  size_t _available;
+  portMUX_TYPE _mux;
+};
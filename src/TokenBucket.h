@@ -0,0 +1,68 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stdint.h>  // for uint*_t
+
+namespace espModbus {
+
+// Request rate limiter: refills `rate` tokens per second up to `burst`,
+// every request takes one. Tokens are kept in thousandths so low rates
+// refill smoothly with a millisecond clock.
+class TokenBucket {
+ public:
+  TokenBucket() :
+    _rate(0),
+    _capacity(0),
+    _tokens(0),
+    _last(0) {}
+
+  // rate in requests per second, 0 disables limiting
+  void configure(uint32_t rate, uint32_t burst, uint32_t now) {
+    _rate = rate;
+    _capacity = burst * 1000;
+    _tokens = _capacity;
+    _last = now;
+  }
+
+  bool take(uint32_t now) {
+    if (_rate == 0) return true;
+    uint64_t tokens = _tokens + static_cast<uint64_t>(now - _last) * _rate;
+    _tokens = tokens > _capacity ? _capacity : static_cast<uint32_t>(tokens);
+    _last = now;
+    if (_tokens < 1000) return false;
+    _tokens -= 1000;
+    return true;
+  }
+
+ private:
+  uint32_t _rate;
+  uint32_t _capacity;
+  uint32_t _tokens;
+  uint32_t _last;
+};
+
+}  // end namespace espModbus
@@ -0,0 +1,138 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include "TrafficCapture.h"
+
+#if defined(ARDUINO)
+
+#include <cstring>  // for memcpy
+
+#include <esp32-hal.h>  // micros()
+
+namespace espModbus {
+
+TrafficCapture::TrafficCapture() :
+  _out(nullptr),
+  _buffer{0},
+  _head(0),
+  _tail(0),
+  _used(0),
+  _lost(0),
+  _dropped(0) {
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+    _mux = mux;
+  }
+
+void TrafficCapture::begin(Print* out) {
+  uint8_t header[capture::HEADER_LENGTH] = {0};
+  memcpy(header, capture::MAGIC, sizeof(capture::MAGIC));
+  header[4] = capture::VERSION;
+  out->write(header, sizeof(header));
+  portENTER_CRITICAL(&_mux);
+  _head = _tail = _used = 0;
+  _lost = _dropped = 0;
+  _out = out;
+  portEXIT_CRITICAL(&_mux);
+}
+
+void TrafficCapture::end() {
+  flush();
+  portENTER_CRITICAL(&_mux);
+  _out = nullptr;
+  portEXIT_CRITICAL(&_mux);
+}
+
+// Only the flushing task consumes, so the bytes between _tail and
+// _tail + _used stay put while they are written out.
+void TrafficCapture::flush() {
+  while (true) {
+    portENTER_CRITICAL(&_mux);
+    Print* out = _out;
+    size_t tail = _tail;
+    size_t len = _used;
+    portEXIT_CRITICAL(&_mux);
+    if (!out || len == 0) return;
+    if (tail + len > CAPTURE_BUFFER_SIZE) len = CAPTURE_BUFFER_SIZE - tail;
+    size_t written = out->write(&_buffer[tail], len);
+    portENTER_CRITICAL(&_mux);
+    _tail = (_tail + written) % CAPTURE_BUFFER_SIZE;
+    _used -= written;
+    portEXIT_CRITICAL(&_mux);
+    if (written < len) return;  // output full, try again later
+  }
+}
+
+uint32_t TrafficCapture::dropped() const {
+  return _dropped;
+}
+
+void TrafficCapture::record(capture::RecordType type, uint8_t connection, const uint8_t* data, size_t len) {
+  if (len > UINT16_MAX) return;
+  uint32_t time = micros();
+  portENTER_CRITICAL(&_mux);
+  if (_out) {
+    if (_lost > 0) {
+      uint8_t lost[4] = {static_cast<uint8_t>(_lost), static_cast<uint8_t>(_lost >> 8),
+                         static_cast<uint8_t>(_lost >> 16), static_cast<uint8_t>(_lost >> 24)};
+      if (_put(capture::DROPPED, connection, time, lost, sizeof(lost))) _lost = 0;
+    }
+    if (_lost > 0 || !_put(type, connection, time, data, len)) {
+      _lost += capture::RECORD_HEADER_LENGTH + len;
+      _dropped += capture::RECORD_HEADER_LENGTH + len;
+    }
+  }
+  portEXIT_CRITICAL(&_mux);
+}
+
+bool TrafficCapture::_put(capture::RecordType type, uint8_t connection, uint32_t time, const uint8_t* data, size_t len) {
+  if (CAPTURE_BUFFER_SIZE - _used < capture::RECORD_HEADER_LENGTH + len) return false;
+  uint8_t header[capture::RECORD_HEADER_LENGTH] = {
+    type,
+    connection,
+    static_cast<uint8_t>(len),
+    static_cast<uint8_t>(len >> 8),
+    static_cast<uint8_t>(time),
+    static_cast<uint8_t>(time >> 8),
+    static_cast<uint8_t>(time >> 16),
+    static_cast<uint8_t>(time >> 24)
+  };
+  _write(header, sizeof(header));
+  _write(data, len);
+  return true;
+}
+
+void TrafficCapture::_write(const uint8_t* data, size_t len) {
+  if (len == 0) return;
+  size_t first = CAPTURE_BUFFER_SIZE - _head;
+  if (first > len) first = len;
+  memcpy(&_buffer[_head], data, first);
+  memcpy(&_buffer[0], data + first, len - first);
+  _head = (_head + len) % CAPTURE_BUFFER_SIZE;
+  _used += len;
+}
+
+}  // end namespace espModbus
+
+#endif
@@ -0,0 +1,100 @@
+/* espModbusSlave
+
+Copyright 2020 Bert Melis
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stdint.h>  // for uint*_t
+#include <stddef.h>  // for size_t
+
+#include "Config.h"
+
+#if defined(ARDUINO)
+#include <FreeRTOS.h>  // portMUX
+#include <Print.h>
+#endif
+
+#ifndef CAPTURE_BUFFER_SIZE
+#define CAPTURE_BUFFER_SIZE 4096  // bytes
+#endif
+
+namespace espModbus {
+
+// Capture file layout, all fields little endian:
+//
+//   header:  "eMBT" version(1) reserved(3)
+//   record:  type(1) connection(1) length(2) time(4, us) payload(length)
+//
+// Connection numbers are reused once a connection closed, a CONNECT
+// record always starts a new stream. Datagrams of the UDP listener are
+// recorded on connection MAX_MODBUS_CLIENTS, each as a DATAGRAM record.
+namespace capture {
+const uint8_t MAGIC[4] = {'e', 'M', 'B', 'T'};
+const uint8_t VERSION = 2;  // 2 added DATAGRAM
+const size_t HEADER_LENGTH = 8;
+const size_t RECORD_HEADER_LENGTH = 8;
+
+enum RecordType : uint8_t {
+  CONNECT = 1,     // payload: IPv4 address of the master
+  DATA = 2,        // payload: bytes as received
+  MESSAGE = 3,     // payload: transaction id(2) unit id(1) function code(1) of a parsed request
+  DISCONNECT = 4,  // no payload
+  DROPPED = 5,     // payload: number of bytes lost(4) because the buffer was full
+  DATAGRAM = 6     // payload: one datagram as received, a frame on its own
+};
+}  // end namespace capture
+
+#if defined(ARDUINO)
+// Records the traffic of all connections of a slave, see capture::RecordType.
+// Recording only copies into a ring buffer, the network task is never
+// blocked on storage. Call flush() regularly from loop() to move the
+// recorded bytes to the output, typically a File. When the buffer is
+// full, records are dropped and a DROPPED record marks the gap.
+class TrafficCapture {
+ public:
+  TrafficCapture();
+  void begin(Print* out);
+  void end();
+  void flush();
+  uint32_t dropped() const;
+  void record(capture::RecordType type, uint8_t connection, const uint8_t* data, size_t len);
+
+ private:
+  TrafficCapture(const TrafficCapture&) = delete;
+  TrafficCapture& operator=(const TrafficCapture&) = delete;
+  bool _put(capture::RecordType type, uint8_t connection, uint32_t time, const uint8_t* data, size_t len);
+  void _write(const uint8_t* data, size_t len);
+
+  Print* _out;
+  uint8_t _buffer[CAPTURE_BUFFER_SIZE];
+  size_t _head;
+  size_t _tail;
+  size_t _used;
+  uint32_t _lost;  // not yet reported in a DROPPED record
+  uint32_t _dropped;
+  portMUX_TYPE _mux;
+};
+#endif
+
+}  // end namespace espModbus
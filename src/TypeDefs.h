@@ -39,6 +39,7 @@ enum FunctionalCode : uint8_t {
   WRITE_HOLD_REGISTER  = 0x06,
   WRITE_MULT_COILS     = 0x0F,
   WRITE_MULT_REGISTERS = 0x10,
+  READ_WRITE_MULT_REGISTERS = 0x17,
   UNDEF                = 0xFF
 };
 